@@ -0,0 +1,9 @@
+/* Generated automatically by running make -- do not edit */
+#ifndef CONFIG_H
+#define CONFIG_H
+#define HAS_unlinkat
+#define HAS_symlinkat
+#define HAS_fstatat
+#define HAS_readlinkat
+#define HAS_openat
+#endif
@@ -43,15 +43,22 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/statfs.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/param.h>
 #include <sys/syscall.h>
+#include <sys/sysmacros.h>
 #include <dirent.h>
 #include <regex.h>
 #include <errno.h>
 #include <limits.h>
 #include <getopt.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 #if defined(__linux__)
 # include <linux/magic.h>
 #endif
@@ -70,6 +77,8 @@
 #endif
 #include "listing.h"
 #include "systemd.h"
+#include "uring.h"
+#include "insservd.h"
 
 #ifdef __m68k__ /* Fix #493637 */
 #  define aligned(a)
@@ -126,11 +135,12 @@ static inline void oneway(char *restrict stop)
 /* Upstart suport */
 static const char *upstartjob_path = "/lib/init/upstart-job";
 
-#ifdef WANT_SYSTEMD
+#ifdef WANT_SYSTEMD_DBUS
 /* Systemd support */
 static DBusConnection *sbus;
+static int dbus_timeout = 10;		/* Seconds to wait for the units */
 
-#endif /* WANT_SYSTEMD */
+#endif /* WANT_SYSTEMD_DBUS */
 
 /*
  * For a description of regular expressions see regex(7).
@@ -180,6 +190,23 @@ static int verbose = 0;
 /* When to be verbose */
 static boolean dryrun = false;
 
+/* Use the regular expressions instead of the keyword lexer for LSB headers */
+static boolean lsb_regex = false;
+
+/* Number of threads scanning the LSB headers */
+static int jobs = 1;
+
+/* Fetch the status and the LSB headers of the scripts with io_uring */
+static boolean uring = false;
+
+/* Order only the services changed since the last run, see follow_all() */
+#define ORDER_FILE	"depend.order"
+static boolean incremental = false;
+static boolean verify_incremental = false;
+
+/* Spool of the operations deferred until --flush, see queue_add() */
+#define QUEUE_FILE	"depend.queue"
+
 /* When paths set do not add root if any */
 static boolean set_override = false;
 static boolean set_insconf = false;
@@ -359,21 +386,12 @@ char **Load_File_Filters()
 
 
 /*
- * Linked list of system facilities services and their replacment
+ * Linked list of system facilities services and their replacment,
+ * the names of the replacements are interned.
  */
-typedef struct string {
-    list_t     s_list;
-    int		  ref;
-    char	*name;
-} __align string_t;
-#define getfstr(arg)	list_entry((arg), struct string, s_list)
-
 typedef struct repl {
     list_t     r_list;
-    struct {
-	string_t   *addr;
-	const char *name;
-    };
+    const char *name;
     ushort	flags;
 } __align repl_t;
 #define getrepl(arg)	list_entry((arg), struct repl, r_list)
@@ -381,11 +399,12 @@ typedef struct repl {
 typedef struct faci {
     list_t	 list;
     list_t    replace;
-    char	*name;
+    const char	*name;
 } __align faci_t;
 #define getfaci(arg)	list_entry((arg), struct faci, list)
 
-static list_t facistr = { &facistr, &facistr }, *facistr_start = &facistr;
+static pool_t pool_repl = POOL(repl_t);
+
 static list_t sysfaci = { &sysfaci, &sysfaci }, *sysfaci_start = &sysfaci;
 
 /*
@@ -407,7 +426,7 @@ static void rememberreq(service_t * restrict serv, uint bit, const char * restri
 
     while ((token = strsep(&tmp, delimeter)) && *token) {
 	service_t * req, * here, * need;
-	boolean found = false;
+	req_t * this;
 
 	bit = old;
 
@@ -431,24 +450,17 @@ static void rememberreq(service_t * restrict serv, uint bit, const char * restri
 		here = serv;
 		need = req;
 	    }
-	    np_list_for_each(ptr, list) {
-		if (!strcmp(getreq(ptr)->serv->name, need->name)) {
-		    getreq(ptr)->flags |= bit;
-		    found = true;
-		    break;
-		}
-	    }
-	    if (!found) {
-		req_t *restrict this;
-		if (posix_memalign((void*)&this, sizeof(void*), alignof(req_t)) != 0)
-		    error("%s", strerror(errno));
-		memset(this, 0, alignof(req_t));
+	    if ((this = (req_t*)edge_get(list, need)))
+		this->flags |= bit;
+	    else {
+		this = (req_t*)pool_get(&pool_req);
 		insert(&this->list, list->prev);
+		edge_put(list, need, this);
 		this->flags = bit;
 		this->serv = need;
 	    }
 	    /* Expand requested services for sorting */
-	    requires(here, need, type);
+	    requires(here, need, type, bit);
 	    break;
 	case '$':
 	    if (strcasecmp(token, "$null") == 0)
@@ -504,7 +516,7 @@ static void reversereq(service_t *restrict serv, uint bit, const char *restrict
 	    /* fall through */
 	default:
 	    rev = addservice(token);
-	    rememberreq(rev, bit, serv->name);
+	    rememberreq(rev, bit|REQ_REV, serv->name);
 	    break;
 	case '$':
 	    list_for_each(ptr, sysfaci_start) {
@@ -547,8 +559,8 @@ static boolean chkrequired(service_t *restrict serv, const boolean recursive)
 	must = req->serv;
 	must = getorig(must);
 
-	if ((must->attr.flags & (SERV_CMDLINE|SERV_ENABLED)) == 0) {
-	    if (recursive) {
+	if ((must->attr.flags & (SERV_CMDLINE|SERV_ENABLED)) == 0 || (must->attr.flags & SERV_REMOVE)) {
+	    if (recursive && (must->attr.flags & SERV_REMOVE) == 0) {
 		must->attr.flags |= SERV_ENFORCE;
 		continue;	/* Enabled this later even if not on command line */
 	    }
@@ -602,7 +614,7 @@ static boolean chkdependencies(service_t *restrict serv)
 	if (!cur)
 	    continue;
 
-	if ((cur->attr.flags & SERV_ENABLED) == 0)
+	if ((cur->attr.flags & SERV_ENABLED) == 0 && (cur->attr.flags & (SERV_CMDLINE|SERV_REMOVE)) != SERV_CMDLINE)
 	    continue;
 
 	if (cur->attr.flags & SERV_DUPLET)
@@ -618,10 +630,10 @@ static boolean chkdependencies(service_t *restrict serv)
 	    if (!(req->flags & REQ_MUST))
 		continue;
 
-	    if (strcmp(req->serv->name, name) != 0)
+	    if (req->serv->name != name)
 		continue;
 
-	    if ((cur->attr.flags & SERV_CMDLINE) && (flags & SERV_CMDLINE))
+	    if ((cur->attr.flags & SERV_REMOVE) && (flags & SERV_REMOVE))
 		continue;
 
 	    warn("FATAL: service %s has to be enabled to use service %s\n",
@@ -709,7 +721,7 @@ static inline void nonlsb_script(void)
 	    }
 
 	    if (req)
-		requires(srv, req, 'S');
+		requires(srv, req, 'S', 0);
 
 	    max = 99;
 	    req = (service_t*)0;
@@ -732,7 +744,7 @@ static inline void nonlsb_script(void)
 	    }
 
 	    if (req)
-		requires(req, srv, 'K');
+		requires(req, srv, 'K', 0);
 	}
     }
 }
@@ -745,19 +757,35 @@ static inline void nonlsb_script(void)
 static inline void active_script(void) attribute((always_inline));
 static inline void active_script(void)
 {
+    service_t ** active = (service_t**)0;
+    uint count = 0, size = 0, n;
     list_t * pos;
     int deep = 1;
 
-    for (deep = 0; deep < 100; deep++) {
-	list_for_each(pos, s_start) {
-	    service_t * serv = getservice(pos);
-	    list_t * tmp;
+    /*
+     * Only the interactive scripts are of interest for each deep
+     */
+    list_for_each(pos, s_start) {
+	service_t * serv = getservice(pos);
 
-	    if (serv->attr.script == (char*)0)
-		continue;
+	if (serv->attr.script == (char*)0)
+	    continue;
 
-	    if ((serv->attr.flags & SERV_INTRACT) == 0)
-		continue;
+	if ((serv->attr.flags & SERV_INTRACT) == 0)
+	    continue;
+
+	if (count == size) {
+	    size = size ? (size << 1) : 8;
+	    if (!(active = (service_t**)realloc(active, size * sizeof(service_t*))))
+		error("%s", strerror(errno));
+	}
+	active[count++] = serv;
+    }
+
+    for (deep = 0; count && deep < 100; deep++) {
+	for (n = 0; n < count; n++) {
+	    service_t * serv = active[n];
+	    list_t * tmp;
 
 	    serv->attr.sorder = getorder(serv->attr.script, 'S');
 
@@ -796,6 +824,7 @@ static inline void active_script(void)
 	    }
 	}
     }
+    free(active);
 }
 
 /*
@@ -836,7 +865,7 @@ static inline void all_script(void)
 	    if (cur->attr.flags & SERV_FIRST)
 		continue;
 
-	    rememberreq(serv, REQ_SHLD|REQ_KILL, cur->name);
+	    rememberreq(serv, REQ_SHLD|REQ_KILL|REQ_ALL, cur->name);
 	}
 
 	setorder(serv->attr.script, 'K', 1, false);
@@ -870,7 +899,7 @@ static inline void all_script(void)
 	    if (cur->attr.flags & SERV_ALL)
 		continue;
 
-	    rememberreq(serv, REQ_SHLD, cur->name);
+	    rememberreq(serv, REQ_SHLD|REQ_ALL, cur->name);
 	}
     }
 }
@@ -1204,13 +1233,46 @@ static inline void makedep(void)
  * Internal logger
  */
 char *myname = (char*)0;
+/*
+ * The messages printed within this run, kept for the snapshot
+ * written by snapshot_save().
+ */
+static char * snapshot_log;
+static size_t snapshot_len, snapshot_size;
+
+static void snapshot_record(const char *restrict const fmt, va_list ap) attribute((nonnull(1)));
+static void snapshot_record(const char *restrict const fmt, va_list ap)
+{
+    va_list aq;
+    int len;
+
+    if (dryrun)
+	return;
+    va_copy(aq, ap);
+    len = vsnprintf((char*)0, 0, fmt, aq);
+    va_end(aq);
+    if (len <= 0)
+	return;
+    if (snapshot_len + len + 1 > snapshot_size) {
+	snapshot_size = (snapshot_len + len + 1) * 2;
+	if (!(snapshot_log = (char*)realloc(snapshot_log, snapshot_size)))
+	    error("%s", strerror(errno));
+    }
+    vsnprintf(snapshot_log + snapshot_len, len + 1, fmt, ap);
+    snapshot_len += len;
+}
+
 static void _logger (const char *restrict const fmt, va_list ap);
 static void _logger (const char *restrict const fmt, va_list ap)
 {
     /* extension char buf[strlen(myname)+2+strlen(fmt)+1]; */
     char buf[strlen(myname)+2+strlen(fmt)+1];
+    va_list aq;
     strcat(strcat(strcpy(buf, myname), ": "), fmt);
+    va_copy(aq, ap);
     vfprintf(stderr, buf, ap);
+    snapshot_record(buf, aq);
+    va_end(aq);
     return;
 }
 
@@ -1256,6 +1318,95 @@ out:
     return;
 }
 
+/*
+ * Time spent within the phases of main() and the counters of the
+ * system calls done, printed by --stats as lines of the form
+ * stats:<kind>:<name>:<value>... on stderr.
+ */
+boolean stats = false;
+ulong stats_count[CNT_MAX];
+static const char *const stats_name[CNT_MAX] = {
+    [CNT_STAT]	   = "stat",
+    [CNT_LSTAT]	   = "lstat",
+    [CNT_READLINK] = "readlink",
+    [CNT_OPEN]	   = "open",
+    [CNT_BYTES]	   = "lsb_bytes",
+    [CNT_REGEXEC]  = "regexec",
+    [CNT_SYMLINK]  = "symlink",
+    [CNT_UNLINK]   = "unlink",
+    [CNT_URING]    = "uring_enter",
+    [CNT_ORDER]    = "ordered",
+};
+
+#define STATS_PHASES	24
+static struct stats_phase {
+    const char	* name;
+    ulong	  wall;			/* Micro seconds */
+    ulong	   cpu;
+} stats_time[STATS_PHASES];
+static uint stats_phases;
+static struct stats_phase * stats_this;
+static struct timespec stats_wall, stats_cpu;
+
+static inline ulong stats_usec(const struct timespec *restrict const now, const struct timespec *restrict const then)
+{
+    return (now->tv_sec - then->tv_sec) * 1000000UL + (now->tv_nsec - then->tv_nsec) / 1000L;
+}
+
+/*
+ * End the current phase and start the next one, if any.  Phases
+ * entered several times are summed up.
+ */
+static void stats_phase(const char *restrict const name)
+{
+    struct timespec wall, cpu;
+    uint n;
+
+    if (!stats)
+	return;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+
+    if (stats_this) {
+	stats_this->wall += stats_usec(&wall, &stats_wall);
+	stats_this->cpu  += stats_usec(&cpu,  &stats_cpu);
+	stats_this = (struct stats_phase*)0;
+    }
+    if (!name)
+	return;
+
+    for (n = 0; n < stats_phases; n++)
+	if (!strcmp(stats_time[n].name, name))
+	    break;
+    if (n == stats_phases) {
+	if (stats_phases >= STATS_PHASES)
+	    return;
+	stats_time[stats_phases++].name = name;
+    }
+    stats_this = &stats_time[n];
+    stats_wall = wall;
+    stats_cpu  = cpu;
+}
+
+static void stats_show(void)
+{
+    struct rusage usage;
+    uint n;
+
+    if (!stats)
+	return;
+    stats_phase((char*)0);
+
+    for (n = 0; n < stats_phases; n++)
+	fprintf(stderr, "stats:phase:%s:%lu:%lu\n", stats_time[n].name, stats_time[n].wall, stats_time[n].cpu);
+    for (n = 0; n < CNT_MAX; n++)
+	fprintf(stderr, "stats:count:%s:%lu\n", stats_name[n], stats_count[n]);
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+	fprintf(stderr, "stats:maxrss:%ld\n", usage.ru_maxrss);
+}
+#undef STATS_PHASES
+
 /*
  *  Check for script in list.
  */
@@ -1291,6 +1442,7 @@ static DIR * openrcdir(const char *restrict const rcpath)
    struct stat st;
    int dfd;
 
+    stats_add(CNT_STAT, 1);
     if (stat(rcpath, &st) < 0) {
 	if (errno == ENOENT) {
 	    info(1, "creating directory '%s'\n", rcpath);
@@ -1301,6 +1453,7 @@ static DIR * openrcdir(const char *restrict const rcpath)
 	    error("can not stat(%s): %s\n", rcpath, strerror(errno));
     }
 
+    stats_add(CNT_OPEN, 1);
     if ((rcdir = opendir(rcpath)) == (DIR*)0) {
 	if (dryrun)
 	    warn ("can not opendir(%s): %s\n", rcpath, strerror(errno));
@@ -1342,24 +1495,173 @@ static inline boolean regexecutor(regex_t *restrict preg,
 static inline boolean regexecutor(regex_t *preg, const char *string,
 	size_t nmatch, regmatch_t pmatch[], int eflags)
 {
-    register int ret = regexec(preg, string, nmatch, pmatch, eflags);
+    register int ret;
+    stats_add(CNT_REGEXEC, 1);
+    ret = regexec(preg, string, nmatch, pmatch, eflags);
     if (ret > REG_NOMATCH) {
-	regerror(ret, preg, buf, sizeof (buf));
-	regfree (preg);
-	warn("%s\n", buf);
+	char msg[LINE_MAX];	/* Not the global buffer, we may run in a scanning thread */
+	regerror(ret, preg, msg, sizeof (msg));
+	warn("%s\n", msg);	/* No regfree(), other threads may use it */
     }
     return (ret ? false : true);
 }
 
+/*
+ * The keyword lexer for the LSB comment block.  It gives the same
+ * results as the regular expressions above but scans each line only
+ * once: the keyword follows the leading hash and optional blanks,
+ * consists of [a-z0-9_-] ignoring case, and ends with a colon.
+ * Words within a keyword are separated by one or more of [-_] and
+ * some keywords may carry an extension prefix x[-_]+[a-z0-9_-]*.
+ */
+#define LSBSLOT(field)	(offsetof(lsb_t, field)/sizeof(char*))
+
+static inline boolean iskeychar(const int c) attribute((always_inline));
+static inline boolean iskeychar(const int c)
+{
+    return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+	    (c >= '0' && c <= '9') || c == '-' || c == '_');
+}
+
+static inline boolean isseparator(const int c) attribute((always_inline));
+static inline boolean isseparator(const int c)
+{
+    return (c == '-' || c == '_');
+}
+
+/*
+ * Match the keyword between ks and ke from its end backwards
+ * against first[-_]+second or first only if second is zero.
+ */
+static boolean lsbkey(const char *const ks, const char *const ke,
+		      const char *restrict const first, const char *restrict const second,
+		      const boolean prefix) attribute((nonnull(1,2,3)));
+static boolean lsbkey(const char *const ks, const char *const ke,
+		      const char *restrict const first, const char *restrict const second,
+		      const boolean prefix)
+{
+    const char * ptr = ke;
+    size_t len;
+
+    if (second) {
+	len = strlen(second);
+	if ((size_t)(ptr - ks) <= len || strncasecmp(ptr - len, second, len))
+	    return false;
+	ptr -= len;
+	if (!isseparator(*(ptr-1)))
+	    return false;
+	while (ptr > ks && isseparator(*(ptr-1)))
+	    ptr--;
+    }
+
+    len = strlen(first);
+    if ((size_t)(ptr - ks) < len || strncasecmp(ptr - len, first, len))
+	return false;
+    ptr -= len;
+
+    if (ptr == ks)
+	return true;
+    if (!prefix || ptr - ks < 2)
+	return false;
+
+    return ((*ks == 'x' || *ks == 'X') && isseparator(*(ks+1)));
+}
+
+/*
+ * Scan one line of an LSB comment block ending before end, the value
+ * is stored into the matching and not yet set entry of the lsb structure.
+ */
+static void lsb_lexline(const char *restrict const line, const char *restrict const end,
+			lsb_t *restrict const lsb) attribute((nonnull(1,2,3)));
+static void lsb_lexline(const char *restrict const line, const char *restrict const end,
+			lsb_t *restrict const lsb)
+{
+    char ** field = (char**)lsb;
+    const char *ks, *ke, *vs, *ve;
+    ssize_t slot = -1;
+
+    if (line == end || *line != '#')
+	return;
+
+    ks = line + 1;
+    while (ks < end && isblank((uchar)*ks))
+	ks++;
+    ke = ks;
+    while (ke < end && iskeychar(*ke))
+	ke++;
+    if (ke == ks || ke == end || *ke != ':')
+	return;
+
+    switch (tolower(*(ke-1))) {
+    case 's':
+	if (lsbkey(ks, ke, "provides", (char*)0, false))
+	    slot = LSBSLOT(provides);
+	break;
+    case 't':
+	if (lsbkey(ks, ke, "required", "start", false))
+	    slot = LSBSLOT(required_start);
+	else if (lsbkey(ks, ke, "should", "start", true))
+	    slot = LSBSLOT(should_start);
+	else if (lsbkey(ks, ke, "default", "start", false))
+	    slot = LSBSLOT(default_start);
+	break;
+    case 'p':
+	if (lsbkey(ks, ke, "required", "stop", false))
+	    slot = LSBSLOT(required_stop);
+	else if (lsbkey(ks, ke, "should", "stop", true))
+	    slot = LSBSLOT(should_stop);
+#ifndef SUSE
+	else if (lsbkey(ks, ke, "default", "stop", false))
+	    slot = LSBSLOT(default_stop);
+#endif
+	break;
+    case 'e':
+	if (lsbkey(ks, ke, "start", "before", true))
+	    slot = LSBSLOT(start_before);
+	else if (lsbkey(ks, ke, "interactive", (char*)0, true))
+	    slot = LSBSLOT(interactive);
+	break;
+    case 'r':
+	if (lsbkey(ks, ke, "stop", "after", true))
+	    slot = LSBSLOT(stop_after);
+	break;
+    case 'n':
+	if (lsbkey(ks, ke, "description", (char*)0, false))
+	    slot = LSBSLOT(description);
+	break;
+    default:
+	break;
+    }
+
+    if (slot < 0 || field[slot])
+	return;
+
+    vs = ke + 1;
+    while (vs < end && isblank((uchar)*vs))
+	vs++;
+    ve = vs;
+    while (ve < end && isprint((uchar)*ve))
+	ve++;
+
+    if (vs < ve)
+	field[slot] = xstrndup(vs, ve - vs);
+    else
+	field[slot] = empty;
+}
+#undef LSBSLOT
+
 /*
  * The script scanning engine.
  * We have to alloc the regular expressions first before
  * calling scan_script_defaults().  After the last call
  * of scan_script_defaults() we may free the expressions.
+ * Both are only required if the keyword lexer is not used.
  */
 static inline void scan_script_regalloc(void) attribute((always_inline));
 static inline void scan_script_regalloc(void)
 {
+    if (!lsb_regex)
+	return;
     regcompiler(&reg.prov,      PROVIDES,       REG_EXTENDED|REG_ICASE);
     regcompiler(&reg.req_start, REQUIRED_START, REG_EXTENDED|REG_ICASE|REG_NEWLINE);
     regcompiler(&reg.req_stop,  REQUIRED_STOP,  REG_EXTENDED|REG_ICASE|REG_NEWLINE);
@@ -1373,20 +1675,23 @@ static inline void scan_script_regalloc(void)
     regcompiler(&reg.interact,  INTERACTIVE,    REG_EXTENDED|REG_ICASE|REG_NEWLINE);
 }
 
+#define LSB_ENTRIES	(int)(sizeof(lsb_t)/sizeof(char*))
+
+static void lsb_free(lsb_t *restrict const lsb) attribute((nonnull(1)));
+static void lsb_free(lsb_t *restrict const lsb)
+{
+    char ** field = (char**)lsb;
+    int n;
+
+    for (n = 0; n < LSB_ENTRIES; n++) {
+	xreset(field[n]);
+    }
+}
+
 static inline void scan_script_reset(void) attribute((always_inline));
 static inline void scan_script_reset(void)
 {
-    xreset(script_inf.provides);
-    xreset(script_inf.required_start);
-    xreset(script_inf.required_stop);
-    xreset(script_inf.should_start);
-    xreset(script_inf.should_stop);
-    xreset(script_inf.start_before);
-    xreset(script_inf.stop_after);
-    xreset(script_inf.default_start);
-    xreset(script_inf.default_stop);
-    xreset(script_inf.description);
-    xreset(script_inf.interactive);
+    lsb_free(&script_inf);
 }
 
 /*
@@ -1413,6 +1718,7 @@ static char *is_upstart_job(const char *path)
 	    break;
 	}
 
+	stats_add(CNT_LSTAT, 1);
 	if (lstat(script, &statbuf) < 0) {
 	    warn("Can not stat %s: %s\n", path, strerror(errno));
 	    break;
@@ -1421,6 +1727,7 @@ static char *is_upstart_job(const char *path)
 	if (!S_ISLNK(statbuf.st_mode))
 	    break;
 
+	stats_add(CNT_READLINK, 1);
 	if ((len = readlink(script, buf, sizeof(buf)-1)) < 0)
 	    break;
 	buf[len] = '\0';
@@ -1460,212 +1767,162 @@ static char *is_upstart_job(const char *path)
 #define FOUND_LSB_OVERRIDE 0x04
 #define FOUND_LSB_UPSTART  0x08
 #define FOUND_LSB_SYSTEMD  0x10
+#define FOUND_LSB_BROKEN   0x20	/* Only used internal for the header cache */
 
 static int o_flags = O_RDONLY;
 
-static uchar scan_lsb_headers(const int dfd, const char *restrict const path,
-			      const boolean cache, const boolean ignore) attribute((nonnull(2)));
-static uchar scan_lsb_headers(const int dfd, const char *restrict const path,
-			      const boolean cache, const boolean ignore)
+/*
+ * Warn about incomplete LSB comments found in path
+ */
+static void lsb_complain(const char *restrict const path) attribute((nonnull(1)));
+static void lsb_complain(const char *restrict const path)
 {
-    regmatch_t subloc[SUBNUM_SHD+1], *val = &subloc[SUBNUM-1], *shl = &subloc[SUBNUM_SHD-1];
-    char *upstart_job = (char*)0;
-    char *begin = (char*)0, *end = (char*)0;
-    char *pbuf = buf;
-    FILE *script;
-    uchar ret = 0;
-    int fd = -1;
-
-#define provides	script_inf.provides
-#define required_start	script_inf.required_start
-#define required_stop	script_inf.required_stop
-#define should_start	script_inf.should_start
-#define should_stop	script_inf.should_stop
-#define start_before	script_inf.start_before
-#define stop_after	script_inf.stop_after
-#define default_start	script_inf.default_start
-#define default_stop	script_inf.default_stop
-#define description	script_inf.description
-#define interactive	script_inf.interactive
-
-    info(2, "Loading %s\n", path);
-
-    if (NULL != (upstart_job = is_upstart_job(path))) {
-	char cmd[PATH_MAX];
-	int len;
-	len = snprintf(cmd, sizeof(cmd), "%s %s lsb-header", upstartjob_path, upstart_job);
-	if (len < 0 || sizeof(cmd) == len)
-	    error("snprintf: insufficient buffer for %s\n", path);
-	if ((script = popen(cmd, "r")) == (FILE*)0)
-	    error("popen(%s): %s\n", path, strerror(errno));
-	ret |= FOUND_LSB_UPSTART;
-    } else {
-	if ((fd = xopen(dfd, path, o_flags)) < 0 || (script = fdopen(fd, "r")) == (FILE*)0)
-	    error("fopen(%s): %s\n", path, strerror(errno));
-
-#if defined _XOPEN_SOURCE && (_XOPEN_SOURCE - 0) >= 600
-	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
-#endif
-    }
+    const lsb_t *const lsb = &script_inf;
+    char *name;
 
-#define COMMON_ARGS	buf, SUBNUM, subloc, 0
-#define COMMON_SHD_ARGS	buf, SUBNUM_SHD, subloc, 0
-    while (fgets(buf, sizeof(buf), script)) {
-
-	/* Skip scanning above from LSB magic start */
-	if (!begin) {
-	    if ( (begin = strstr(buf, "### BEGIN INIT INFO")) ) {
-	        /* Let the latest LSB header override the one found earlier */
-	        scan_script_reset();
-	    }
-	    continue;
-	}
+    if (lsb->provides && (lsb->provides != empty) &&
+#ifdef SUSE
+	lsb->required_start && lsb->required_stop && lsb->default_start)
+#else  /* not SUSE */
+	lsb->required_start && lsb->required_stop && lsb->default_start && lsb->default_stop)
+#endif /* not SUSE */
+	return;
 
-	if (!provides       && regexecutor(&reg.prov,      COMMON_ARGS) == true) {
-	    if (val->rm_so < val->rm_eo) {
-		*(pbuf+val->rm_eo) = '\0';
-	        provides = xstrdup(pbuf+val->rm_so);
-	    } else
-		provides = empty;
-	}
-	if (!required_start && regexecutor(&reg.req_start, COMMON_ARGS) == true) {
-	    if (val->rm_so < val->rm_eo) {
-		*(pbuf+val->rm_eo) = '\0';
-		required_start = xstrdup(pbuf+val->rm_so);
-	    } else
-		required_start = empty;
-	}
-	if (!required_stop  && regexecutor(&reg.req_stop,  COMMON_ARGS) == true) {
-	    if (val->rm_so < val->rm_eo) {
-		*(pbuf+val->rm_eo) = '\0';
-		required_stop = xstrdup(pbuf+val->rm_so);
-	    } else
-		required_stop = empty;
-	}
-	if (!should_start && regexecutor(&reg.shl_start,   COMMON_SHD_ARGS) == true) {
-	    if (shl->rm_so < shl->rm_eo) {
-		*(pbuf+shl->rm_eo) = '\0';
-		should_start = xstrdup(pbuf+shl->rm_so);
-	    } else
-		should_start = empty;
-	}
-	if (!should_stop  && regexecutor(&reg.shl_stop,    COMMON_SHD_ARGS) == true) {
-	    if (shl->rm_so < shl->rm_eo) {
-		*(pbuf+shl->rm_eo) = '\0';
-		should_stop = xstrdup(pbuf+shl->rm_so);
-	    } else
-		should_stop = empty;
-	}
-	if (!start_before && regexecutor(&reg.start_bf,    COMMON_SHD_ARGS) == true) {
-	    if (shl->rm_so < shl->rm_eo) {
-		*(pbuf+shl->rm_eo) = '\0';
-		start_before = xstrdup(pbuf+shl->rm_so);
-	    } else
-		start_before = empty;
-	}
-	if (!stop_after  && regexecutor(&reg.stop_af,      COMMON_SHD_ARGS) == true) {
-	    if (shl->rm_so < shl->rm_eo) {
-		*(pbuf+shl->rm_eo) = '\0';
-		stop_after = xstrdup(pbuf+shl->rm_so);
-	    } else
-		stop_after = empty;
-	}
-	if (!default_start  && regexecutor(&reg.def_start, COMMON_ARGS) == true) {
-	    if (val->rm_so < val->rm_eo) {
-		*(pbuf+val->rm_eo) = '\0';
-		default_start = xstrdup(pbuf+val->rm_so);
-	    } else
-		default_start = empty;
-	}
+    name = basename(path);
+    if (*name == 'S' || *name == 'K')
+	name += 3;
+    warn("script %s is broken: incomplete LSB comment.\n", name);
+    if (!lsb->provides)
+	warn("missing `Provides:' entry: please add.\n");
+    if (lsb->provides == empty)
+	warn("missing valid name for `Provides:' please add.\n");
+    if (!lsb->required_start)
+	warn("missing `Required-Start:' entry: please add even if empty.\n");
+    if (!lsb->required_stop)
+	warn("missing `Required-Stop:'  entry: please add even if empty.\n");
+    if (!lsb->default_start)
+	warn("missing `Default-Start:'  entry: please add even if empty.\n");
 #ifndef SUSE
-	if (!default_stop   && regexecutor(&reg.def_stop,  COMMON_ARGS) == true) {
-	    if (val->rm_so < val->rm_eo) {
-		*(pbuf+val->rm_eo) = '\0';
-		default_stop = xstrdup(pbuf+val->rm_so);
-	    } else
-		default_stop = empty;
-	}
+    if (!lsb->default_stop)
+	warn("missing `Default-Stop:'   entry: please add even if empty.\n");
 #endif
-	if (!description    && regexecutor(&reg.desc,      COMMON_ARGS) == true) {
-	    if (val->rm_so < val->rm_eo) {
-		*(pbuf+val->rm_eo) = '\0';
-		description = xstrdup(pbuf+val->rm_so);
-	    } else
-		description = empty;
-	}
+}
 
-	if (!interactive    && regexecutor(&reg.interact,  COMMON_SHD_ARGS) == true) {
-	    if (shl->rm_so < shl->rm_eo) {
-		*(pbuf+shl->rm_eo) = '\0';
-		interactive = xstrdup(pbuf+shl->rm_so);
-	    } else
-		interactive = empty;
-	}
+static void lsb_broken(const char *restrict const path, const boolean ignore) attribute((nonnull(1)));
+static void lsb_broken(const char *restrict const path, const boolean ignore)
+{
+    char *name = basename(path);
+    if (*name == 'S' || *name == 'K')
+	name += 3;
+    warn("%sscript %s is broken: missing end of LSB comment.\n", ignore ? "" : "FATAL: ", name);
+    if (!ignore)
+	error("exiting now!\n");
+}
 
-	/* Skip scanning below from LSB magic end */
-	if ((end = strstr(buf, "### END INIT INFO")))
-	    break;
-    }
-#undef COMMON_ARGS
-#undef COMMON_SHD_ARGS
+/*
+ * Scan one line of an LSB comment block with the regular expressions.
+ */
+static void lsb_regline(char *restrict const line, lsb_t *restrict const lsb) attribute((nonnull(1,2)));
+static void lsb_regline(char *restrict const line, lsb_t *restrict const lsb)
+{
+    regmatch_t subloc[SUBNUM_SHD+1], *val = &subloc[SUBNUM-1], *shl = &subloc[SUBNUM_SHD-1];
 
-    if (upstart_job) {
-	pclose(script);
-	xreset(upstart_job);
-    } else {
-#if defined _XOPEN_SOURCE && (_XOPEN_SOURCE - 0) >= 600
-	if (cache) {
-	    off_t deep = ftello(script);
-	    if (-1 != deep) {
-	        (void)posix_fadvise(fd, 0, deep, POSIX_FADV_WILLNEED);
-		(void)posix_fadvise(fd, deep, 0, POSIX_FADV_DONTNEED);
-	    } else
-	        warn("ftello(%s) failed: %s\n", path, strerror(errno));
+#define provides	lsb->provides
+#define required_start	lsb->required_start
+#define required_stop	lsb->required_stop
+#define should_start	lsb->should_start
+#define should_stop	lsb->should_stop
+#define start_before	lsb->start_before
+#define stop_after	lsb->stop_after
+#define default_start	lsb->default_start
+#define default_stop	lsb->default_stop
+#define description	lsb->description
+#define interactive	lsb->interactive
+
+#define COMMON_ARGS	line, SUBNUM, subloc, 0
+#define COMMON_SHD_ARGS	line, SUBNUM_SHD, subloc, 0
+    if (!provides       && regexecutor(&reg.prov,      COMMON_ARGS) == true) {
+	if (val->rm_so < val->rm_eo) {
+	    *(line+val->rm_eo) = '\0';
+	    provides = xstrdup(line+val->rm_so);
 	} else
-	    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
-#endif
-	fclose(script);
+	    provides = empty;
     }
-
-    if (begin && end)
-	ret |= FOUND_LSB_HEADER;
-
-    if (begin && !end) {
-	char *name = basename(path);
-	if (*name == 'S' || *name == 'K')
-	    name += 3;
-	warn("%sscript %s is broken: missing end of LSB comment.\n", ignore ? "" : "FATAL: ", name);
-	if (!ignore)
-	    error("exiting now!\n");
+    if (!required_start && regexecutor(&reg.req_start, COMMON_ARGS) == true) {
+	if (val->rm_so < val->rm_eo) {
+	    *(line+val->rm_eo) = '\0';
+	    required_start = xstrdup(line+val->rm_so);
+	} else
+	    required_start = empty;
+    }
+    if (!required_stop  && regexecutor(&reg.req_stop,  COMMON_ARGS) == true) {
+	if (val->rm_so < val->rm_eo) {
+	    *(line+val->rm_eo) = '\0';
+	    required_stop = xstrdup(line+val->rm_so);
+	} else
+	    required_stop = empty;
+    }
+    if (!should_start && regexecutor(&reg.shl_start,   COMMON_SHD_ARGS) == true) {
+	if (shl->rm_so < shl->rm_eo) {
+	    *(line+shl->rm_eo) = '\0';
+	    should_start = xstrdup(line+shl->rm_so);
+	} else
+	    should_start = empty;
+    }
+    if (!should_stop  && regexecutor(&reg.shl_stop,    COMMON_SHD_ARGS) == true) {
+	if (shl->rm_so < shl->rm_eo) {
+	    *(line+shl->rm_eo) = '\0';
+	    should_stop = xstrdup(line+shl->rm_so);
+	} else
+	    should_stop = empty;
+    }
+    if (!start_before && regexecutor(&reg.start_bf,    COMMON_SHD_ARGS) == true) {
+	if (shl->rm_so < shl->rm_eo) {
+	    *(line+shl->rm_eo) = '\0';
+	    start_before = xstrdup(line+shl->rm_so);
+	} else
+	    start_before = empty;
+    }
+    if (!stop_after  && regexecutor(&reg.stop_af,      COMMON_SHD_ARGS) == true) {
+	if (shl->rm_so < shl->rm_eo) {
+	    *(line+shl->rm_eo) = '\0';
+	    stop_after = xstrdup(line+shl->rm_so);
+	} else
+	    stop_after = empty;
+    }
+    if (!default_start  && regexecutor(&reg.def_start, COMMON_ARGS) == true) {
+	if (val->rm_so < val->rm_eo) {
+	    *(line+val->rm_eo) = '\0';
+	    default_start = xstrdup(line+val->rm_so);
+	} else
+	    default_start = empty;
     }
-
-    if (begin && end && (!provides || (provides == empty) ||
-#ifdef SUSE
-			 !required_start || !required_stop || !default_start
-#else  /* not SUSE */
-			 !required_start || !required_stop || !default_start || !default_stop
-#endif /* not SUSE */
-	))
-    {
-	char *name = basename(path);
-	if (*name == 'S' || *name == 'K')
-	    name += 3;
-	warn("script %s is broken: incomplete LSB comment.\n", name);
-	if (!provides)
-	    warn("missing `Provides:' entry: please add.\n");
-	if (provides == empty)
-	    warn("missing valid name for `Provides:' please add.\n");
-	if (!required_start)
-	    warn("missing `Required-Start:' entry: please add even if empty.\n");
-	if (!required_stop)
-	    warn("missing `Required-Stop:'  entry: please add even if empty.\n");
-	if (!default_start)
-	    warn("missing `Default-Start:'  entry: please add even if empty.\n");
 #ifndef SUSE
-	if (!default_stop)
-	    warn("missing `Default-Stop:'   entry: please add even if empty.\n");
+    if (!default_stop   && regexecutor(&reg.def_stop,  COMMON_ARGS) == true) {
+	if (val->rm_so < val->rm_eo) {
+	    *(line+val->rm_eo) = '\0';
+	    default_stop = xstrdup(line+val->rm_so);
+	} else
+	    default_stop = empty;
+    }
 #endif
+    if (!description    && regexecutor(&reg.desc,      COMMON_ARGS) == true) {
+	if (val->rm_so < val->rm_eo) {
+	    *(line+val->rm_eo) = '\0';
+	    description = xstrdup(line+val->rm_so);
+	} else
+	    description = empty;
+    }
+
+    if (!interactive    && regexecutor(&reg.interact,  COMMON_SHD_ARGS) == true) {
+	if (shl->rm_so < shl->rm_eo) {
+	    *(line+shl->rm_eo) = '\0';
+	    interactive = xstrdup(line+shl->rm_so);
+	} else
+	    interactive = empty;
     }
+#undef COMMON_ARGS
+#undef COMMON_SHD_ARGS
 
 #undef provides
 #undef required_start
@@ -1678,40 +1935,240 @@ static uchar scan_lsb_headers(const int dfd, const char *restrict const path,
 #undef default_stop
 #undef description
 #undef interactive
-    return ret;
 }
 
+#define LSB_BEGIN	"### BEGIN INIT INFO"
+#define LSB_END		"### END INIT INFO"
+#define LSB_PREFIX	4096	/* Bytes of a script read before it is mapped or by io_uring */
+
 /*
- * Follow symlinks, return the basename of the file pointed to by
- * symlinks or the basename of the current path if no symlink.
+ * Parse the LSB comment block found within the bytes of a script into
+ * lsb, only the lines between the magic start and end are scanned.
+ * Returns FOUND_LSB_HEADER for a complete block and FOUND_LSB_BROKEN if
+ * its end is missing.  Only local state is used, this is also called
+ * by the scanning threads.
  */
-static char * scriptname(int dfd, const char *restrict const path, char **restrict first) attribute((malloc,nonnull(2)));
-static char * scriptname(int dfd, const char *restrict const path, char **restrict first)
+static uchar lsb_parse(const char *restrict const data, const size_t len,
+		       lsb_t *restrict const lsb) attribute((nonnull(1,3)));
+static uchar lsb_parse(const char *restrict const data, const size_t len,
+		       lsb_t *restrict const lsb)
 {
-    uint deep = 0;
-    char linkbuf[PATH_MAX+1];
-    char *script = xstrdup(path);
+    const char *const stop = data + len;
+    const char *begin, *end, *ptr;
+    char line[LINE_MAX];
 
-    strncpy(linkbuf, script, sizeof(linkbuf)-1);
-    linkbuf[PATH_MAX] = '\0';
+    if (!(begin = memmem(data, len, LSB_BEGIN, sizeof(LSB_BEGIN)-1))) {
+	stats_add(CNT_BYTES, len);
+	return 0;
+    }
+    /* Let the latest LSB header override the one found earlier */
+    lsb_free(lsb);
 
-    do {
-	struct stat st;
-	int linklen;
+    /* Skip scanning above from LSB magic start and below from LSB magic end */
+    if ((ptr = memchr(begin, '\n', stop - begin)))
+	ptr++;
+    else
+	ptr = stop;
+    if ((end = memmem(ptr, stop - ptr, LSB_END, sizeof(LSB_END)-1))) {
+	if ((end = memchr(end, '\n', stop - end)))
+	    end++;
+	else
+	    end = stop;
+    }
+    stats_add(CNT_BYTES, (end ? end : stop) - data);
+
+    while (ptr < (end ? end : stop)) {
+	const char * eol = memchr(ptr, '\n', (end ? end : stop) - ptr);
+
+	eol = eol ? eol + 1 : (end ? end : stop);
+	if (lsb_regex) {
+	    size_t n = eol - ptr;
+	    if (n > sizeof(line) - 1)
+		n = sizeof(line) - 1;
+	    memcpy(line, ptr, n);
+	    line[n] = '\0';
+	    lsb_regline(line, lsb);
+	} else
+	    lsb_lexline(ptr, eol, lsb);
+	ptr = eol;
+    }
 
-	if (deep++ > MAXSYMLINKS) {
-	    errno = ELOOP;
-	    warn("Can not determine script name for %s: %s\n", path, strerror(errno));
-	    break;
-	}
+    return end ? FOUND_LSB_HEADER : FOUND_LSB_BROKEN;
+}
+
+/*
+ * Read the LSB comment block of the script open at fd into lsb.  Only
+ * the first bytes of the script are read, the whole script is mapped
+ * if the block does not end within them.  The number of bytes of the
+ * script needed is stored in deep.
+ */
+static uchar lsb_load(const int fd, lsb_t *restrict const lsb, off_t *restrict const deep) attribute((nonnull(2,3)));
+static uchar lsb_load(const int fd, lsb_t *restrict const lsb, off_t *restrict const deep)
+{
+    char head[LSB_PREFIX];
+    struct stat st;
+    ssize_t len;
+    uchar ret;
+    void * map;
+
+    *deep = 0;
+    if ((len = pread(fd, head, sizeof(head), 0)) <= 0)
+	return 0;
+    ret = lsb_parse(head, len, lsb);
+    *deep = len;
+    if ((ret & FOUND_LSB_HEADER) || len < (ssize_t)sizeof(head))
+	return ret;
+
+    if (fstat(fd, &st) < 0 || st.st_size <= len)
+	return ret;
+    map = mmap((void*)0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+	return ret;
+    ret = lsb_parse((const char*)map, st.st_size, lsb);
+    *deep = st.st_size;
+    munmap(map, st.st_size);
+    return ret;
+}
+
+/*
+ * Read the LSB comment block from the output of a command into lsb.
+ */
+static uchar lsb_read(FILE *restrict const script, lsb_t *restrict const lsb) attribute((nonnull(1,2)));
+static uchar lsb_read(FILE *restrict const script, lsb_t *restrict const lsb)
+{
+    char * data = (char*)0;
+    size_t len = 0, size = 0;
+    uchar ret;
+
+    do {
+	if (len == size) {
+	    size += LSB_PREFIX;
+	    if (!(data = (char*)realloc(data, size)))
+		error("%s", strerror(errno));
+	}
+	len += fread(data + len, 1, size - len, script);
+    } while (len == size);
+
+    ret = lsb_parse(data, len, lsb);
+    free(data);
+    return ret;
+}
+
+/*
+ * Tell about the results of lsb_parse() for path found in script_inf
+ */
+static void lsb_report(const char *restrict const path, const uchar found,
+		       const boolean ignore) attribute((nonnull(1)));
+static void lsb_report(const char *restrict const path, const uchar found,
+		       const boolean ignore)
+{
+    if ((found & FOUND_LSB_HEADER) && verbose > 2) {
+	static const char *const keys[] = {
+	    "Provides", "Required-Start", "Required-Stop", "Should-Start",
+	    "Should-Stop", "X-Start-Before", "X-Stop-After", "Default-Start",
+	    "Default-Stop", "Description", "X-Interactive"
+	};
+	char *const *const field = (char *const *)&script_inf;
+	size_t n;
+
+	for (n = 0; n < sizeof(keys)/sizeof(keys[0]); n++) {
+	    if (field[n])
+		info(3, "%s: %s: `%s'\n", path, keys[n], field[n]);
+	}
+    }
+
+    if (found & FOUND_LSB_BROKEN)
+	lsb_broken(path, ignore);
+
+    if (found & FOUND_LSB_HEADER)
+	lsb_complain(path);
+}
+
+static uchar scan_lsb_headers(const int dfd, const char *restrict const path,
+			      const boolean cache, const boolean ignore) attribute((nonnull(2)));
+static uchar scan_lsb_headers(const int dfd, const char *restrict const path,
+			      const boolean cache, const boolean ignore)
+{
+    char *upstart_job = (char*)0;
+    uchar ret = 0, found;
+
+    info(2, "Loading %s\n", path);
+
+    if (NULL != (upstart_job = is_upstart_job(path))) {
+	char cmd[PATH_MAX];
+	FILE *script;
+	int len;
+	len = snprintf(cmd, sizeof(cmd), "%s %s lsb-header", upstartjob_path, upstart_job);
+	if (len < 0 || sizeof(cmd) == len)
+	    error("snprintf: insufficient buffer for %s\n", path);
+	if ((script = popen(cmd, "r")) == (FILE*)0)
+	    error("popen(%s): %s\n", path, strerror(errno));
+	ret |= FOUND_LSB_UPSTART;
+	found = lsb_read(script, &script_inf);
+	pclose(script);
+	xreset(upstart_job);
+    } else {
+	off_t deep;
+	int fd;
+
+	if ((fd = xopen(dfd, path, o_flags)) < 0)
+	    error("fopen(%s): %s\n", path, strerror(errno));
+	found = lsb_load(fd, &script_inf, &deep);
+#if defined _XOPEN_SOURCE && (_XOPEN_SOURCE - 0) >= 600
+	if (cache) {
+	    (void)posix_fadvise(fd, 0, deep, POSIX_FADV_WILLNEED);
+	    (void)posix_fadvise(fd, deep, 0, POSIX_FADV_DONTNEED);
+	} else
+	    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+#endif
+	close(fd);
+    }
+
+    lsb_report(path, found, ignore);
+    return ret|found;
+}
+
+/*
+ * Follow symlinks, return the basename of the file pointed to by
+ * symlinks or the basename of the current path if no symlink.
+ * If target is given it holds the status of the file pointed to,
+ * its inode is zero if the file could not be determined.
+ */
+static char * scriptname(int dfd, const char *restrict const path, char **restrict first,
+			 struct stat *restrict target) attribute((malloc,nonnull(2)));
+static char * scriptname(int dfd, const char *restrict const path, char **restrict first,
+			 struct stat *restrict target)
+{
+    uint deep = 0;
+    char linkbuf[PATH_MAX+1];
+    char *script = xstrdup(path);
+
+    strncpy(linkbuf, script, sizeof(linkbuf)-1);
+    linkbuf[PATH_MAX] = '\0';
+
+    if (target)
+	memset(target, 0, sizeof(struct stat));
+
+    do {
+	struct stat st;
+	int linklen;
+
+	if (deep++ > MAXSYMLINKS) {
+	    errno = ELOOP;
+	    warn("Can not determine script name for %s: %s\n", path, strerror(errno));
+	    break;
+	}
 
 	if (xlstat(dfd, script, &st) < 0) {
 	    warn("Can not stat %s: %s\n", script, strerror(errno));
 	    break;
 	}
 
-	if (!S_ISLNK(st.st_mode))
+	if (!S_ISLNK(st.st_mode)) {
+	    if (target)
+		*target = st;
 	    break;
+	}
 
 	if ((linklen = xreadlink(dfd, script, linkbuf, sizeof(linkbuf)-1)) < 0)
 	    break;
@@ -1745,6 +2202,18 @@ static char * scriptname(int dfd, const char *restrict const path, char **restri
     return script;
 }
 
+static void override_file(char *restrict const fullpath,
+			  const char *restrict const dir,
+			  const char *restrict const name) attribute((nonnull(1,2,3)));
+static void override_file(char *restrict const fullpath,
+			  const char *restrict const dir,
+			  const char *restrict const name)
+{
+    int n = snprintf(fullpath, PATH_MAX+1, "%s%s/%s", (root && !set_override) ? root : "", dir, name);
+    if (n >= PATH_MAX+1 || n < 0)
+	error("snprintf(): %s\n", strerror(errno));
+}
+
 static uchar load_overrides(const char *restrict const dir,
 			    const char *restrict const name,
 			    const boolean cache, const boolean ignore) attribute((nonnull(1,2)));
@@ -1752,20 +2221,1080 @@ static uchar load_overrides(const char *restrict const dir,
 			    const char *restrict const name,
 			    const boolean cache, const boolean ignore)
 {
-    uchar ret = 0;
-    char fullpath[PATH_MAX+1];
-    struct stat statbuf;
-    int n;
+    uchar ret = 0;
+    char fullpath[PATH_MAX+1];
+    struct stat statbuf;
+
+    override_file(fullpath, dir, name);
+
+    stats_add(CNT_STAT, 1);
+    if (stat(fullpath, &statbuf) == 0 && S_ISREG(statbuf.st_mode))
+	ret = scan_lsb_headers(-1, fullpath, cache, ignore);
+    if (ret & FOUND_LSB_HEADER)
+	ret |= FOUND_LSB_OVERRIDE;
+    return ret;
+}
+
+/*
+ * The persistent cache of LSB headers.  Each entry is found by the
+ * name of the script and is valid as long as the identities of the
+ * script and of its both override files are unchanged.  The cache
+ * file lives beside the dependency files.
+ */
+#define LSBCACHE_FILE	"depend.cache"
+#define LSBCACHE_MAGIC	"insserv-lsbcache"
+#ifdef SUSE
+# define LSBCACHE_VERSION	0x53550001U
+#else
+# define LSBCACHE_VERSION	0x44450001U
+#endif
+#define LSB_NONE	0xffffffffU
+
+typedef struct ident_struct {
+    uint64_t		     dev;
+    uint64_t		     ino;
+    uint64_t		    size;
+    uint64_t		   mtime;	/* in nano seconds */
+} ident_t;
+
+typedef struct lsbcache_struct {
+    list_t		  c_list;
+    ident_t		ident[3];	/* The script and its override files */
+    uchar		   flags;
+    boolean		    used;
+    lsb_t		     lsb;
+    char		  * name;
+} lsbcache_t;
+#define getlsbcache(arg)	list_entry((arg), struct lsbcache_struct, c_list)
+
+static list_t lsbcache = { &lsbcache, &lsbcache };
+static hash_t lsbcacheidx;
+static boolean lsbcache_dirty = false;
+static char lsbcache_path[PATH_MAX+1];	/* The cache file loaded */
+static ident_t lsbcache_ident;		/* Its identity when loaded */
+
+/*
+ * Get the identity of a file, which is all zero if not found.
+ */
+static void get_ident(const int dfd, const char *restrict const path,
+		      ident_t *restrict const id, const boolean regular) attribute((nonnull(2,3)));
+static void get_ident(const int dfd, const char *restrict const path,
+		      ident_t *restrict const id, const boolean regular)
+{
+    struct stat st;
+
+    memset(id, 0, sizeof(ident_t));
+    if (xstat(dfd, path, &st) < 0)
+	return;
+    if (regular && !S_ISREG(st.st_mode))
+	return;
+    id->dev   = (uint64_t)st.st_dev;
+    id->ino   = (uint64_t)st.st_ino;
+    id->size  = (uint64_t)st.st_size;
+    id->mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
+}
+
+/*
+ * Duplicate LSB results with respect of the empty marker.
+ */
+static void lsb_copy(lsb_t *restrict const dst, const lsb_t *restrict const src) attribute((nonnull(1,2)));
+static void lsb_copy(lsb_t *restrict const dst, const lsb_t *restrict const src)
+{
+    char *const *const from = (char *const *)src;
+    char ** to = (char**)dst;
+    int n;
+
+    for (n = 0; n < LSB_ENTRIES; n++) {
+	if (!from[n] || from[n] == empty)
+	    to[n] = from[n];
+	else
+	    to[n] = xstrdup(from[n]);
+    }
+}
+
+static lsbcache_t * lsbcache_add(const char *restrict const name) attribute((nonnull(1)));
+static lsbcache_t * lsbcache_add(const char *restrict const name)
+{
+    lsbcache_t * this = (lsbcache_t*)hash_get(&lsbcacheidx, name);
+
+    if (this) {
+	lsb_free(&this->lsb);
+	goto out;
+    }
+
+    if (posix_memalign((void*)&this, sizeof(void*), alignof(lsbcache_t)+strsize(name)) != 0)
+	error("%s", strerror(errno));
+    memset(this, 0, alignof(lsbcache_t)+strsize(name));
+    this->name = ((char*)this)+alignof(lsbcache_t);
+    strcpy(this->name, name);
+    insert(&this->c_list, lsbcache.prev);
+
+    *hash_put(&lsbcacheidx, this->name) = (void*)this;
+out:
+    return this;
+}
+
+/*
+ * Find a valid cache entry and copy its results
+ */
+static boolean lsbcache_get(const char *restrict const name,
+			    const ident_t ident[3], uchar *restrict const flags) attribute((nonnull(1,2,3)));
+static boolean lsbcache_get(const char *restrict const name,
+			    const ident_t ident[3], uchar *restrict const flags)
+{
+    lsbcache_t * this = (lsbcache_t*)hash_get(&lsbcacheidx, name);
+
+    if (!this || memcmp(this->ident, ident, sizeof(this->ident)))
+	return false;
+
+    info(2, "Using cached LSB header of %s\n", name);
+    this->used = true;
+    lsb_copy(&script_inf, &this->lsb);
+    *flags = this->flags;
+    return true;
+}
+
+/*
+ * Remember the current results of a script
+ */
+static void lsbcache_put(const char *restrict const name,
+			 const ident_t ident[3], const uchar flags) attribute((nonnull(1,2)));
+static void lsbcache_put(const char *restrict const name,
+			 const ident_t ident[3], const uchar flags)
+{
+    lsbcache_t * this = lsbcache_add(name);
+
+    memcpy(this->ident, ident, sizeof(this->ident));
+    lsb_copy(&this->lsb, &script_inf);
+    this->flags = flags;
+    this->used = true;
+    lsbcache_dirty = true;
+}
+
+/*
+ * The per run memo of parsed LSB headers, a script linked into
+ * several runlevels is read only once.  The key is the device and
+ * inode of the file pointed to together with the script name.
+ */
+typedef struct lsbmemo_struct {
+    uchar		   flags;
+    lsb_t		     lsb;
+    char		  * key;
+} lsbmemo_t;
+
+static hash_t lsbmemoidx;
+
+static inline void lsbmemo_key(char *restrict const key, const size_t len,
+			       const struct stat *restrict const st,
+			       const char *restrict const name) attribute((always_inline,nonnull(1,3,4)));
+static inline void lsbmemo_key(char *restrict const key, const size_t len,
+			       const struct stat *restrict const st,
+			       const char *restrict const name)
+{
+    int n = snprintf(key, len, "%llu:%llu:%s", (unsigned long long)st->st_dev,
+		     (unsigned long long)st->st_ino, name);
+    if (n < 0 || (size_t)n >= len)
+	error("snprintf(): %s\n", strerror(ENAMETOOLONG));
+}
+
+/*
+ * Replay the warnings of a script already seen and copy its results
+ */
+static boolean lsbmemo_get(const struct stat *restrict const st, const char *restrict const name,
+			   const char *restrict const path, const boolean ignore,
+			   uchar *restrict const flags) attribute((nonnull(1,2,3,5)));
+static boolean lsbmemo_get(const struct stat *restrict const st, const char *restrict const name,
+			   const char *restrict const path, const boolean ignore,
+			   uchar *restrict const flags)
+{
+    char key[PATH_MAX+64];
+    lsbmemo_t * this;
+
+    lsbmemo_key(key, sizeof(key), st, name);
+    if (!(this = (lsbmemo_t*)hash_get(&lsbmemoidx, key)))
+	return false;
+
+    info(2, "Reusing LSB header of %s for %s\n", name, path);
+    lsb_copy(&script_inf, &this->lsb);
+    if (this->flags & FOUND_LSB_BROKEN)
+	lsb_broken(path, ignore);
+    if (this->flags & FOUND_LSB_HEADER)
+	lsb_complain((this->flags & FOUND_LSB_OVERRIDE) ? name : path);
+    *flags = this->flags;
+    return true;
+}
+
+static void lsbmemo_put(const struct stat *restrict const st, const char *restrict const name,
+			const uchar flags) attribute((nonnull(1,2)));
+static void lsbmemo_put(const struct stat *restrict const st, const char *restrict const name,
+			const uchar flags)
+{
+    char key[PATH_MAX+64];
+    lsbmemo_t * this;
+    void ** slot;
+
+    lsbmemo_key(key, sizeof(key), st, name);
+    if (hash_get(&lsbmemoidx, key))
+	return;
+
+    if (posix_memalign((void*)&this, sizeof(void*), alignof(lsbmemo_t)+strsize(key)) != 0)
+	error("%s", strerror(errno));
+    this->key = ((char*)this)+alignof(lsbmemo_t);
+    strcpy(this->key, key);
+    lsb_copy(&this->lsb, &script_inf);
+    this->flags = flags;
+
+    slot = hash_put(&lsbmemoidx, this->key);
+    *slot = (void*)this;
+}
+
+/*
+ * Parse the LSB headers of all scripts of the init.d directory at
+ * once with several threads.  Each thread reads the override files
+ * and the script just like scan_script_defaults() does but quietly,
+ * the results are taken in the usual order by scan_script_defaults()
+ * which then tells about the files read.  Only regular files are
+ * scanned, scripts known by the cache and symbolic links to upstart
+ * jobs are left to the serial scan.
+ */
+#define LSBJOB_STEPS	3	/* The override, the third party override, and the script */
+#define LSBJOB_SKIP	0xff	/* File not read */
+
+typedef struct lsbjob_struct {
+    lsb_t		     lsb;
+    uchar		   flags;
+    uchar   step[LSBJOB_STEPS];	/* Result of lsb_parse() for each file */
+    boolean		  usable;
+    boolean		 fetched;	/* Members below set by lsbjob_uring() */
+    ident_t ident[LSBJOB_STEPS];
+    mode_t  mode[LSBJOB_STEPS-1];	/* File types of the override files */
+    char		  * head;	/* First bytes of the script */
+    uint		 headlen;
+    char		  * name;
+    char		   * key;
+} lsbjob_t;
+
+typedef struct lsbpool_struct {
+    lsbjob_t		   * job;
+    uint		   count;
+    uint		    next;	/* Next job to be done, shared by the threads */
+    int			     dfd;
+    const char	  * override;
+} lsbpool_t;
+
+static lsbpool_t lsbpool;
+static hash_t lsbjobidx;
+
+/*
+ * Read the file of one step into the results of a job
+ */
+static boolean lsbjob_read(lsbjob_t *restrict const job, const uint step, const int dfd,
+			   const char *restrict const path) attribute((nonnull(1,4)));
+static boolean lsbjob_read(lsbjob_t *restrict const job, const uint step, const int dfd,
+			   const char *restrict const path)
+{
+    off_t deep;
+    int fd;
+
+    if ((fd = xopen(dfd, path, o_flags)) < 0)
+	return false;
+    job->step[step] = lsb_load(fd, &job->lsb, &deep);
+#if defined _XOPEN_SOURCE && (_XOPEN_SOURCE - 0) >= 600
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+#endif
+    close(fd);
+    return true;
+}
+
+/*
+ * Parse the first bytes of the script read by lsbjob_uring(), this
+ * is enough if the LSB comment block ends within or if these are
+ * all bytes of the script.
+ */
+static boolean lsbjob_head(lsbjob_t *restrict const job, const uint step) attribute((nonnull(1)));
+static boolean lsbjob_head(lsbjob_t *restrict const job, const uint step)
+{
+    boolean ret = true;
+
+    job->step[step] = lsb_parse(job->head, job->headlen, &job->lsb);
+    if (!(job->step[step] & FOUND_LSB_HEADER) && job->headlen < job->ident[0].size)
+	ret = false;
+
+    free(job->head);
+    job->head = (char*)0;
+    return ret;
+}
+
+static void lsbjob_run(lsbjob_t *restrict const job) attribute((nonnull(1)));
+static void lsbjob_run(lsbjob_t *restrict const job)
+{
+    static const char *const overrides = "/usr/share/insserv/overrides";
+    const lsbcache_t * cached;
+    char fullpath[PATH_MAX+1];
+    ident_t ident[3];
+    uint step;
+
+    memset(job->step, LSBJOB_SKIP, sizeof(job->step));
+
+    if (job->fetched)
+	memcpy(ident, job->ident, sizeof(ident));
+    else {
+	get_ident(lsbpool.dfd, job->name, &ident[0], false);
+	override_file(fullpath, lsbpool.override, job->name);
+	get_ident(-1, fullpath, &ident[1], true);
+	override_file(fullpath, overrides, job->name);
+	get_ident(-1, fullpath, &ident[2], true);
+    }
+
+    cached = (lsbcache_t*)hash_get(&lsbcacheidx, job->name);
+    if (cached && !memcmp(cached->ident, ident, sizeof(ident)))
+	return;				/* Nothing to do */
+
+    for (step = 0; step < LSBJOB_STEPS - 1; step++) {
+	struct stat st;
+
+	override_file(fullpath, step ? overrides : lsbpool.override, job->name);
+	if (*fullpath != '/')
+	    return;			/* Relative to the directory of the serial scan */
+	if (job->fetched)
+	    st.st_mode = job->mode[step];
+	else if (xlstat(AT_FDCWD, fullpath, &st) < 0)
+	    continue;
+	if (S_ISLNK(st.st_mode))
+	    return;			/* Could be an upstart job */
+	if (!S_ISREG(st.st_mode))
+	    continue;
+	if (!lsbjob_read(job, step, AT_FDCWD, fullpath))
+	    return;
+	if (job->step[step] & FOUND_LSB_HEADER)
+	    job->step[step] |= FOUND_LSB_OVERRIDE;
+	job->flags |= job->step[step];
+	if (job->flags & FOUND_LSB_OVERRIDE)
+	    goto out;
+    }
+
+    if (job->head && lsbjob_head(job, step))
+	goto done;
+    if (!lsbjob_read(job, step, lsbpool.dfd, job->name))
+	return;
+done:
+    job->flags |= job->step[step];
+out:
+    job->usable = true;
+}
+
+static void * lsbjob_thread(void *arg);
+static void * lsbjob_thread(void *arg)
+{
+    uint n;
+
+    while ((n = __atomic_fetch_add(&lsbpool.next, 1, __ATOMIC_RELAXED)) < lsbpool.count)
+	lsbjob_run(&lsbpool.job[n]);
+    return arg;
+}
+
+/*
+ * Fetch the identities of the scripts and their override files as
+ * well as the first bytes of the scripts with batches of io_uring
+ * requests instead of a chain of system calls for each script.
+ * Without io_uring all of this is left to lsbjob_run().
+ */
+static void lsbjob_ident(ident_t *restrict const id, const struct statx *restrict const stx,
+			 const int res, const boolean regular) attribute((nonnull(1,2)));
+static void lsbjob_ident(ident_t *restrict const id, const struct statx *restrict const stx,
+			 const int res, const boolean regular)
+{
+    memset(id, 0, sizeof(ident_t));
+    if (res < 0)
+	return;
+    if (regular && !S_ISREG(stx->stx_mode))
+	return;
+    id->dev   = (uint64_t)makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    id->ino   = (uint64_t)stx->stx_ino;
+    id->size  = (uint64_t)stx->stx_size;
+    id->mtime = (uint64_t)stx->stx_mtime.tv_sec * 1000000000ULL + (uint64_t)stx->stx_mtime.tv_nsec;
+}
+
+static void lsbjob_uring(void)
+{
+    const uint count = lsbpool.count;
+    struct statx * stx;
+    uring_op_t * op;
+    char ** path;
+    uint * which;
+    uint n, k, m, reads = 0;
+
+    if (!count || !uring_open(256))
+	return;
+
+    op    = (uring_op_t*)calloc(count * LSBJOB_STEPS, sizeof(uring_op_t));
+    stx   = (struct statx*)calloc(count * LSBJOB_STEPS, sizeof(struct statx));
+    path  = (char**)calloc(count * (LSBJOB_STEPS - 1), sizeof(char*));
+    which = (uint*)calloc(count, sizeof(uint));
+    if (!op || !stx || !path || !which)
+	error("%s", strerror(errno));
+
+    for (n = 0; n < count; n++) {
+	uring_op_t *const this = &op[n * LSBJOB_STEPS];
+	const lsbjob_t *const job = &lsbpool.job[n];
+
+	for (k = 0; k < LSBJOB_STEPS; k++) {
+	    this[k].opcode = URING_STATX;
+	    this[k].buf = &stx[n * LSBJOB_STEPS + k];
+	    if (k == 0) {
+		this[k].dfd = lsbpool.dfd;
+		this[k].path = job->name;
+	    } else {
+		char fullpath[PATH_MAX+1];
+
+		override_file(fullpath, k > 1 ? "/usr/share/insserv/overrides" : lsbpool.override, job->name);
+		path[n * (LSBJOB_STEPS - 1) + k - 1] = xstrdup(fullpath);
+		this[k].dfd = AT_FDCWD;
+		this[k].path = path[n * (LSBJOB_STEPS - 1) + k - 1];
+		this[k].flags = AT_SYMLINK_NOFOLLOW;
+	    }
+	}
+    }
+    if (!uring_run(op, count * LSBJOB_STEPS))
+	goto out;
+    for (n = 0; n < count * LSBJOB_STEPS; n++)
+	if (op[n].res == -EINVAL)
+	    goto out;			/* The kernel does not know statx requests */
+
+    for (n = 0; n < count; n++) {
+	const uring_op_t *const this = &op[n * LSBJOB_STEPS];
+	lsbjob_t *const job = &lsbpool.job[n];
+	const lsbcache_t * cached;
+
+	if (this[0].res < 0)
+	    continue;
+	for (k = 0; k < LSBJOB_STEPS - 1; k++)
+	    job->mode[k] = this[k+1].res < 0 ? 0 : stx[n * LSBJOB_STEPS + k + 1].stx_mode;
+	if (S_ISLNK(job->mode[0]) || S_ISLNK(job->mode[1]))
+	    continue;			/* Identities are those of the targets */
+	for (k = 0; k < LSBJOB_STEPS; k++)
+	    lsbjob_ident(&job->ident[k], &stx[n * LSBJOB_STEPS + k], this[k].res, k > 0);
+	job->fetched = true;
+
+	cached = (lsbcache_t*)hash_get(&lsbcacheidx, job->name);
+	if (cached && !memcmp(cached->ident, job->ident, sizeof(job->ident)))
+	    continue;
+	if (S_ISREG(job->mode[0]) || S_ISREG(job->mode[1]))
+	    continue;			/* Override files are read by lsbjob_run() */
+
+	job->headlen = job->ident[0].size < LSB_PREFIX ? (uint)job->ident[0].size : LSB_PREFIX;
+	if (!(job->head = (char*)malloc(job->headlen + 1)))
+	    error("%s", strerror(errno));
+	if (job->headlen)
+	    which[reads++] = n;
+    }
+
+    /*
+     * Open the scripts, read their first bytes, and close them.
+     */
+    memset(op, 0, reads * sizeof(uring_op_t));
+    for (m = 0; m < reads; m++) {
+	op[m].opcode = URING_OPENAT;
+	op[m].dfd = lsbpool.dfd;
+	op[m].path = lsbpool.job[which[m]].name;
+	op[m].flags = o_flags;
+    }
+    uring_run(op, reads);
+    for (m = 0; m < reads; m++) {
+	lsbjob_t *const job = &lsbpool.job[which[m]];
+	const int fd = op[m].res;
+
+	memset(&op[m], 0, sizeof(uring_op_t));
+	if (fd < 0) {
+	    free(job->head);
+	    job->head = (char*)0;
+	    op[m].opcode = URING_CLOSE;
+	    op[m].dfd = -1;
+	    continue;
+	}
+	op[m].opcode = URING_READ;
+	op[m].dfd = fd;
+	op[m].buf = job->head;
+	op[m].len = job->headlen;
+    }
+    uring_run(op, reads);
+    for (m = 0; m < reads; m++) {
+	lsbjob_t *const job = &lsbpool.job[which[m]];
+
+	if (op[m].opcode != URING_READ)
+	    continue;
+	if (op[m].res < 0) {
+	    free(job->head);
+	    job->head = (char*)0;
+	} else
+	    job->headlen = (uint)op[m].res;
+	op[m].opcode = URING_CLOSE;
+    }
+    if (!uring_run(op, reads)) {
+	for (m = 0; m < reads; m++)
+	    if (op[m].dfd >= 0 && op[m].res == -ECANCELED)
+		close(op[m].dfd);
+    }
+out:
+    uring_close();
+    for (n = 0; n < count * (LSBJOB_STEPS - 1); n++)
+	free(path[n]);
+    free(which);
+    free(path);
+    free(stx);
+    free(op);
+}
+
+static void lsbjob_start(const char *restrict const path, const char *restrict const override_path,
+			 const int jobs) attribute((nonnull(1,2)));
+static void lsbjob_start(const char *restrict const path, const char *restrict const override_path,
+			 const int jobs)
+{
+    pthread_t * thread;
+    struct dirent *d;
+    uint size = 0, n;
+    long cpus;
+    int started = 0, threads;
+    DIR * dir;
+
+    stats_add(CNT_OPEN, 1);
+    if (!(dir = opendir(path)))
+	return;
+    lsbpool.dfd = dirfd(dir);
+    lsbpool.override = override_path;
+
+    while ((d = readdir(dir))) {
+	struct stat st;
+	lsbjob_t * job;
+
+	if (*d->d_name == '.')
+	    continue;
+	if (xlstat(lsbpool.dfd, d->d_name, &st) < 0 || !S_ISREG(st.st_mode))
+	    continue;
+	if (lsbpool.count == size) {
+	    size = size ? size * 2 : 64;
+	    if (!(lsbpool.job = (lsbjob_t*)realloc(lsbpool.job, size * sizeof(lsbjob_t))))
+		error("%s", strerror(errno));
+	}
+	job = &lsbpool.job[lsbpool.count++];
+	memset(job, 0, sizeof(lsbjob_t));
+	job->name = xstrdup(d->d_name);
+	job->key = (char*)malloc(PATH_MAX+64);
+	if (!job->key)
+	    error("%s", strerror(errno));
+	lsbmemo_key(job->key, PATH_MAX+64, &st, job->name);
+    }
+
+    if (uring)
+	lsbjob_uring();
+
+    /*
+     * No more threads than jobs in the pool nor than online CPUs,
+     * we do our part as well.
+     */
+    threads = jobs - 1;
+    if ((uint)threads > lsbpool.count)
+	threads = lsbpool.count;
+    if ((cpus = sysconf(_SC_NPROCESSORS_ONLN)) > 0 && threads > cpus - 1)
+	threads = cpus - 1;
+    thread = (pthread_t*)0;
+    if (threads > 0 && !(thread = (pthread_t*)malloc(threads * sizeof(pthread_t))))
+	error("%s", strerror(errno));
+
+    while (started < threads) {
+	if (pthread_create(&thread[started], (pthread_attr_t*)0, lsbjob_thread, (void*)0) != 0)
+	    break;
+	started++;
+    }
+    lsbjob_thread((void*)0);		/* Do our part */
+    while (started--)
+	pthread_join(thread[started], (void**)0);
+    free(thread);
+
+    for (n = 0; n < lsbpool.count; n++) {
+	lsbjob_t * job = &lsbpool.job[n];
+	if (job->usable)
+	    *hash_put(&lsbjobidx, job->key) = (void*)job;
+    }
+    closedir(dir);
+}
+
+/*
+ * Take the results of a script parsed by a thread and tell about
+ * the files read as scan_lsb_headers() would have done.
+ */
+static boolean lsbjob_get(const struct stat *restrict const st, const char *restrict const name,
+			  const char *restrict const path, const char *restrict const override_path,
+			  const boolean ignore, uchar *restrict const flags) attribute((nonnull(1,2,3,4,6)));
+static boolean lsbjob_get(const struct stat *restrict const st, const char *restrict const name,
+			  const char *restrict const path, const char *restrict const override_path,
+			  const boolean ignore, uchar *restrict const flags)
+{
+    char key[PATH_MAX+64];
+    lsbjob_t * job;
+    uint step;
+
+    if (!lsbpool.count)
+	return false;
+    lsbmemo_key(key, sizeof(key), st, name);
+    if (!(job = (lsbjob_t*)hash_get(&lsbjobidx, key)))
+	return false;
+
+    lsb_copy(&script_inf, &job->lsb);
+    for (step = 0; step < LSBJOB_STEPS; step++) {
+	char fullpath[PATH_MAX+1];
+	const char * file = path;
+
+	if (job->step[step] == LSBJOB_SKIP)
+	    continue;
+	if (step < LSBJOB_STEPS - 1) {
+	    override_file(fullpath, step ? "/usr/share/insserv/overrides" : override_path, name);
+	    file = fullpath;
+	}
+	info(2, "Loading %s\n", file);
+	lsb_report(file, job->step[step], ignore);
+    }
+    *flags = job->flags;
+    return true;
+}
+
+static void lsbjob_free(void)
+{
+    uint n;
+
+    for (n = 0; n < lsbpool.count; n++) {
+	lsb_free(&lsbpool.job[n].lsb);
+	free(lsbpool.job[n].head);
+	free(lsbpool.job[n].name);
+	free(lsbpool.job[n].key);
+    }
+    free(lsbpool.job);
+    hash_free(&lsbjobidx);
+    memset(&lsbpool, 0, sizeof(lsbpool));
+}
+
+static inline boolean lsbcache_read(const char **restrict ptr, const char *restrict const end,
+				    void *restrict val, const size_t len) attribute((always_inline,nonnull(1,2,3)));
+static inline boolean lsbcache_read(const char **restrict ptr, const char *restrict const end,
+				    void *restrict val, const size_t len)
+{
+    if ((size_t)(end - *ptr) < len)
+	return false;
+    memcpy(val, *ptr, len);
+    *ptr += len;
+    return true;
+}
+
+static boolean lsbcache_read_str(const char **restrict ptr, const char *restrict const end,
+				 char **restrict str) attribute((nonnull(1,2,3)));
+static boolean lsbcache_read_str(const char **restrict ptr, const char *restrict const end,
+				 char **restrict str)
+{
+    uint32_t len;
+
+    if (!lsbcache_read(ptr, end, &len, sizeof(len)))
+	return false;
+    if (len == LSB_NONE) {
+	*str = (char*)0;
+	return true;
+    }
+    if (len == 0) {
+	*str = empty;
+	return true;
+    }
+    if ((size_t)(end - *ptr) < len || memchr(*ptr, '\0', len))
+	return false;
+    if (!(*str = strndup(*ptr, len)))
+	error("%s", strerror(errno));
+    *ptr += len;
+    return true;
+}
+
+static void lsbcache_drop(void)
+{
+    list_t * ptr, * safe;
+
+    list_for_each_safe(ptr, safe, &lsbcache) {
+	lsbcache_t * this = getlsbcache(ptr);
+	delete(ptr);
+	lsb_free(&this->lsb);
+	free(this);
+    }
+    hash_free(&lsbcacheidx);
+    *lsbcache_path = '\0';
+}
+
+/*
+ * Load the cache file, any inconsistency drops the rest of the file.
+ * Nothing is done if the same file is already loaded.
+ */
+static void lsbcache_load(void)
+{
+    char magic[sizeof(LSBCACHE_MAGIC)];
+    char file[PATH_MAX+1];
+    const char *ptr, *end;
+    char *data = (char*)0;
+    uint32_t version, count;
+    ident_t ident;
+    struct stat st;
+    int fd;
+
+    snprintf(file, sizeof(file), "%s" LSBCACHE_FILE, dependency_path);
+    stats_add(CNT_OPEN, 1);
+    if ((fd = open(file, O_RDONLY|O_CLOEXEC)) < 0)
+	return;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+	goto out;
+
+    memset(&ident, 0, sizeof(ident));
+    ident.dev   = (uint64_t)st.st_dev;
+    ident.ino   = (uint64_t)st.st_ino;
+    ident.size  = (uint64_t)st.st_size;
+    ident.mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
+    if (!strcmp(lsbcache_path, file) && !memcmp(&ident, &lsbcache_ident, sizeof(ident)))
+	goto out;
+    lsbcache_drop();
+    strcpy(lsbcache_path, file);
+    lsbcache_ident = ident;
+
+    if (!(data = (char*)malloc(st.st_size)))
+	error("%s", strerror(errno));
+    if (read(fd, data, st.st_size) != st.st_size)
+	goto out;
+
+    ptr = data;
+    end = data + st.st_size;
+    if (!lsbcache_read(&ptr, end, magic, sizeof(magic)) || memcmp(magic, LSBCACHE_MAGIC, sizeof(magic)))
+	goto bad;
+    if (!lsbcache_read(&ptr, end, &version, sizeof(version)) || version != LSBCACHE_VERSION)
+	goto bad;
+    if (!lsbcache_read(&ptr, end, &count, sizeof(count)))
+	goto bad;
+
+    while (count--) {
+	ident_t ident[3];
+	lsbcache_t * this;
+	char * name;
+	lsb_t lsb;
+	uchar flags;
+	char ** field = (char**)&lsb;
+	int n;
+
+	if (!lsbcache_read_str(&ptr, end, &name) || !name || name == empty)
+	    goto bad;
+	memset(&lsb, 0, sizeof(lsb));
+	if (!lsbcache_read(&ptr, end, ident, sizeof(ident)) ||
+	    !lsbcache_read(&ptr, end, &flags, sizeof(flags))) {
+	    free(name);
+	    goto bad;
+	}
+	for (n = 0; n < LSB_ENTRIES; n++) {
+	    if (!lsbcache_read_str(&ptr, end, &field[n])) {
+		lsb_free(&lsb);
+		free(name);
+		goto bad;
+	    }
+	}
+	this = lsbcache_add(name);
+	memcpy(this->ident, ident, sizeof(this->ident));
+	this->lsb = lsb;
+	this->flags = flags;
+	free(name);
+    }
+    goto out;
+bad:
+    info(1, "ignoring corrupted %s\n", file);
+    lsbcache_dirty = true;
+out:
+    free(data);
+    close(fd);
+}
+
+static void lsbcache_write_str(FILE *restrict out, const char *restrict str) attribute((nonnull(1)));
+static void lsbcache_write_str(FILE *restrict out, const char *restrict str)
+{
+    uint32_t len = LSB_NONE;
+
+    if (str)
+	len = (str == empty) ? 0 : strlen(str);
+    fwrite(&len, sizeof(len), 1, out);
+    if (str && len)
+	fwrite(str, sizeof(char), len, out);
+}
+
+/*
+ * Write back all entries used within this run
+ */
+static void lsbcache_save(void)
+{
+    char file[PATH_MAX+1], temp[PATH_MAX+1];
+    const uint32_t version = LSBCACHE_VERSION;
+    uint32_t count = 0;
+    list_t * ptr;
+    FILE * out;
+    int fd;
+
+    list_for_each(ptr, &lsbcache) {
+	if (getlsbcache(ptr)->used)
+	    count++;
+	else
+	    lsbcache_dirty = true;
+    }
+
+    if (dryrun || !lsbcache_dirty)
+	return;
+
+    snprintf(file, sizeof(file), "%s" LSBCACHE_FILE, dependency_path);
+    snprintf(temp, sizeof(temp), "%s" LSBCACHE_FILE ".XXXXXX", dependency_path);
+    if ((fd = mkstemp(temp)) < 0 || !(out = fdopen(fd, "w"))) {
+	info(1, "can not write %s: %s\n", file, strerror(errno));
+	if (fd >= 0) {
+	    close(fd);
+	    unlink(temp);
+	}
+	return;
+    }
+    (void)fchmod(fd, 0644);
+
+    fwrite(LSBCACHE_MAGIC, sizeof(LSBCACHE_MAGIC), 1, out);
+    fwrite(&version, sizeof(version), 1, out);
+    fwrite(&count, sizeof(count), 1, out);
+
+    list_for_each(ptr, &lsbcache) {
+	lsbcache_t * this = getlsbcache(ptr);
+	char ** field = (char**)&this->lsb;
+	int n;
+
+	if (!this->used)
+	    continue;
+	lsbcache_write_str(out, this->name);
+	fwrite(this->ident, sizeof(this->ident), 1, out);
+	fwrite(&this->flags, sizeof(this->flags), 1, out);
+	for (n = 0; n < LSB_ENTRIES; n++)
+	    lsbcache_write_str(out, field[n]);
+    }
+
+    if (fclose(out) != 0 || rename(temp, file) != 0) {
+	info(1, "can not write %s: %s\n", file, strerror(errno));
+	unlink(temp);
+    }
+}
+
+/*
+ * The snapshot of a run which has changed nothing.  It holds the
+ * fingerprint of all inputs, that is the command line, the program,
+ * the configuration, the scripts, the override files, the upstart
+ * jobs, the runlevel directories, and the dependency files, together
+ * with the messages printed by the run.  If a later run finds the
+ * same fingerprint it would change nothing either, then the messages
+ * are printed again and the run ends at once.
+ */
+#define SNAPSHOT_FILE	 "depend.snapshot"
+#define SNAPSHOT_MAGIC	 "insserv snapshot"
+#define SNAPSHOT_VERSION 1
+#define FNV_BASIS	 0xcbf29ce484222325ULL
+#define FNV_PRIME	 0x100000001b3ULL
+
+static uint64_t snapshot_args;		/* Fingerprint of the command line */
+static uint64_t snapshot_start;		/* Fingerprint of the inputs found on start */
+
+static inline uint64_t fnv(uint64_t h, const void *restrict const data, size_t len) attribute((always_inline,nonnull(2)));
+static inline uint64_t fnv(uint64_t h, const void *restrict const data, size_t len)
+{
+    const uchar * ptr = (const uchar*)data;
+
+    while (len--) {
+	h ^= *ptr++;
+	h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static void snapshot_cmdline(const int argc, char *const argv[]) attribute((nonnull(2)));
+static void snapshot_cmdline(const int argc, char *const argv[])
+{
+    char * pwd = getcwd((char*)0, 0);
+    uint64_t h = FNV_BASIS;
+    int n;
+
+    for (n = 0; n < argc; n++)
+	h = fnv(h, argv[n], strlen(argv[n]) + 1);
+    if (pwd) {
+	h = fnv(h, pwd, strlen(pwd) + 1);
+	free(pwd);
+    }
+    snapshot_args = h;
+}
+
+/*
+ * Fingerprint of a file or of the entries of a directory.  The
+ * entries are summed up as readdir(3) gives no order, the own
+ * files of insserv and hidden files are skipped.
+ */
+static uint64_t snapshot_path(uint64_t h, const char *restrict const path, const boolean entries) attribute((nonnull(2)));
+static uint64_t snapshot_path(uint64_t h, const char *restrict const path, const boolean entries)
+{
+    struct dirent * d;
+    uint64_t sum = 0;
+    ident_t id;
+    DIR * dir;
+
+    h = fnv(h, path, strlen(path) + 1);
+    if (!entries) {
+	get_ident(-1, path, &id, false);
+	return fnv(h, &id, sizeof(id));
+    }
+
+    if ((dir = opendir(path))) {
+	const int dfd = dirfd(dir);
+
+	while ((d = readdir(dir))) {
+	    uint64_t e;
+
+	    if (*d->d_name == '.' || !strncmp(d->d_name, "depend.", 7))
+		continue;
+	    get_ident(dfd, d->d_name, &id, false);
+	    e = fnv(FNV_BASIS, d->d_name, strlen(d->d_name) + 1);
+	    sum += fnv(e, &id, sizeof(id));
+	}
+	closedir(dir);
+    }
+    return fnv(h, &sum, sizeof(sum));
+}
+
+static uint64_t snapshot_fingerprint(const char *restrict const path, const char *restrict const override_path,
+				     const char *restrict const insconf) attribute((nonnull(1,2,3)));
+static uint64_t snapshot_fingerprint(const char *restrict const path, const char *restrict const override_path,
+				     const char *restrict const insconf)
+{
+    static const char *const depend[] = { "boot", "start", "stop", "halt" };
+    char buf[PATH_MAX+1];
+    uint64_t h = snapshot_args;
+    int n;
+
+    h = snapshot_path(h, "/proc/self/exe", false);
+    snprintf(buf, sizeof(buf), "%s%s", (root && !set_insconf) ? root : "", insconf);
+    h = snapshot_path(h, buf, false);
+    snprintf(buf, sizeof(buf), "%s%s.d", (root && !set_insconf) ? root : "", insconf);
+    h = snapshot_path(h, buf, true);
+    h = snapshot_path(h, FILE_FILTER_PATH, false);
+
+    h = snapshot_path(h, path, true);
+    override_file(buf, override_path, "");
+    h = snapshot_path(h, buf, true);
+    override_file(buf, "/usr/share/insserv/overrides", "");
+    h = snapshot_path(h, buf, true);
+
+    /* The headers of upstart jobs are given by their job files */
+    h = snapshot_path(h, upstartjob_path, false);
+    h = snapshot_path(h, "/etc/init", true);
+
+    for (n = 0; n < map_has_runlevels(); n++) {
+	snprintf(buf, sizeof(buf), "%s/%s", path, map_runlevel_to_location(n));
+	h = snapshot_path(h, buf, false);
+    }
+
+    /* Rewritten by each run, therefore without the time of change */
+    for (n = 0; n < (int)(sizeof(depend)/sizeof(depend[0])); n++) {
+	struct stat st;
+	uint64_t id[2] = { 0, 0 };
+
+	snprintf(buf, sizeof(buf), "%sdepend.%s", dependency_path, depend[n]);
+	if (stat(buf, &st) == 0) {
+	    id[0] = (uint64_t)st.st_ino;
+	    id[1] = (uint64_t)st.st_size;
+	}
+	h = fnv(h, id, sizeof(id));
+    }
+    return h;
+}
+
+/*
+ * Replay the messages of the snapshot if its fingerprint is the
+ * one of the inputs found on start.
+ */
+static boolean snapshot_load(void)
+{
+    char file[PATH_MAX+1];
+    const char *ptr, *end;
+    uint32_t version, len;
+    uint64_t fingerprint;
+    boolean ret = false;
+    struct stat st;
+    void * map;
+    int fd;
+
+    snprintf(file, sizeof(file), "%s" SNAPSHOT_FILE, dependency_path);
+    stats_add(CNT_OPEN, 1);
+    if ((fd = open(file, O_RDONLY|O_CLOEXEC)) < 0)
+	return false;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+	goto out;
+    map = mmap((void*)0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+	goto out;
+
+    ptr = (const char*)map;
+    end = ptr + st.st_size;
+    if ((size_t)(end - ptr) < sizeof(SNAPSHOT_MAGIC) || memcmp(ptr, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)))
+	goto unmap;
+    ptr += sizeof(SNAPSHOT_MAGIC);
+    if (!lsbcache_read(&ptr, end, &version, sizeof(version)) || version != SNAPSHOT_VERSION)
+	goto unmap;
+    if (!lsbcache_read(&ptr, end, &fingerprint, sizeof(fingerprint)) || fingerprint != snapshot_start)
+	goto unmap;
+    if (!lsbcache_read(&ptr, end, &len, sizeof(len)) || (size_t)(end - ptr) != len)
+	goto unmap;
+
+    info(1, "nothing changed since the last run, see %s\n", file);
+    if (len)
+	fwrite(ptr, sizeof(char), len, stderr);
+    ret = true;
+unmap:
+    munmap(map, st.st_size);
+out:
+    close(fd);
+    return ret;
+}
+
+/*
+ * Write the snapshot if this run has changed nothing
+ */
+static void snapshot_save(const char *restrict const path, const char *restrict const override_path,
+			  const char *restrict const insconf) attribute((nonnull(1,2,3)));
+static void snapshot_save(const char *restrict const path, const char *restrict const override_path,
+			  const char *restrict const insconf)
+{
+    char file[PATH_MAX+1], temp[PATH_MAX+1];
+    const uint32_t version = SNAPSHOT_VERSION;
+    const uint32_t len = snapshot_len;
+    uint64_t fingerprint;
+    FILE * out;
+    int fd;
+
+    if ((fingerprint = snapshot_fingerprint(path, override_path, insconf)) != snapshot_start)
+	return;
 
-    n = snprintf(&fullpath[0], sizeof(fullpath), "%s%s/%s", (root && !set_override) ? root : "", dir, name);
-    if (n >= (int)sizeof(fullpath) || n < 0)
-	error("snprintf(): %s\n", strerror(errno));
+    snprintf(file, sizeof(file), "%s" SNAPSHOT_FILE, dependency_path);
+    snprintf(temp, sizeof(temp), "%s" SNAPSHOT_FILE ".XXXXXX", dependency_path);
+    if ((fd = mkstemp(temp)) < 0 || !(out = fdopen(fd, "w"))) {
+	if (fd >= 0) {
+	    close(fd);
+	    unlink(temp);
+	}
+	return;
+    }
+    (void)fchmod(fd, 0644);
 
-    if (stat(fullpath, &statbuf) == 0 && S_ISREG(statbuf.st_mode))
-	ret = scan_lsb_headers(-1, fullpath, cache, ignore);
-    if (ret & FOUND_LSB_HEADER)
-	ret |= FOUND_LSB_OVERRIDE;
-    return ret;
+    fwrite(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC), 1, out);
+    fwrite(&version, sizeof(version), 1, out);
+    fwrite(&fingerprint, sizeof(fingerprint), 1, out);
+    fwrite(&len, sizeof(len), 1, out);
+    if (len)
+	fwrite(snapshot_log, sizeof(char), len, out);
+
+    if (fclose(out) != 0 || rename(temp, file) != 0)
+	unlink(temp);
 }
 
 static uchar scan_script_defaults(int dfd, const char *const restrict path,
@@ -1777,9 +3306,12 @@ static uchar scan_script_defaults(int dfd, const char *restrict const path,
 				  char **restrict first,
 				  const boolean cache, const boolean ignore)
 {
-    char * name = scriptname(dfd, path, first);
-    uchar ret = 0;
+    struct stat st;
+    char * name = scriptname(dfd, path, first, &st);
+    char fullpath[PATH_MAX+1];
+    uchar ret = 0, flags = 0;
     char *upstart_job = (char*)0;
+    ident_t ident[3];
 
     if (!name)
 	return ret;
@@ -1831,27 +3363,67 @@ static uchar scan_script_defaults(int dfd, const char *restrict const path,
 	    goto out;
     }
 
+    /*
+     * Each script is parsed once per run even if
+     * found by several links in the runlevels.
+     */
+    if (st.st_ino && lsbmemo_get(&st, name, path, ignore, &flags)) {
+	ret |= flags;
+	goto out;
+    }
+
+    /*
+     * Use the cached results if neither the script nor
+     * one of its override files has been changed and the
+     * regular expressions are not asked for.
+     */
+    get_ident(dfd, path, &ident[0], false);
+    override_file(fullpath, override_path, name);
+    get_ident(-1, fullpath, &ident[1], true);
+    override_file(fullpath, "/usr/share/insserv/overrides", name);
+    get_ident(-1, fullpath, &ident[2], true);
+
+    if (ident[0].ino && !lsb_regex && lsbcache_get(name, ident, &flags)) {
+	if (flags & FOUND_LSB_HEADER)
+	    lsb_complain((flags & FOUND_LSB_OVERRIDE) ? name : path);
+	goto memo;
+    }
+
+    /*
+     * Use the results of the scanning threads if any.
+     */
+    if (st.st_ino && lsbjob_get(&st, name, path, override_path, ignore, &flags))
+	goto store;
+
     /*
      * Allow host-specific overrides to replace the content in the
      * init.d scripts
      */
-    ret |= load_overrides(override_path, name, cache, ignore);
-    if (ret & FOUND_LSB_OVERRIDE)
-	goto out;
+    flags = load_overrides(override_path, name, cache, ignore);
+    if (flags & FOUND_LSB_OVERRIDE)
+	goto store;
 
     /*
      * Load third-party-specific values if the override file exist
      */
-    ret |= load_overrides("/usr/share/insserv/overrides", name, cache, ignore);
-    if (ret & FOUND_LSB_OVERRIDE)
-	goto out;
+    flags |= load_overrides("/usr/share/insserv/overrides", name, cache, ignore);
+    if (flags & FOUND_LSB_OVERRIDE)
+	goto store;
 
     /*
      * Replace with headers from the script itself
      */
-    ret |= scan_lsb_headers(dfd, path, cache, ignore);
+    flags |= scan_lsb_headers(dfd, path, cache, ignore);
+store:
+    if (ident[0].ino && !(flags & FOUND_LSB_BROKEN))
+	lsbcache_put(name, ident, flags);
+memo:
+    if (st.st_ino)
+	lsbmemo_put(&st, name, flags);
+    ret |= flags;
 out:
     ret |= FOUND_LSB_DEFAULT;
+    ret &= ~FOUND_LSB_BROKEN;
     free(name);
     return ret;
 }
@@ -1859,6 +3431,8 @@ out:
 static inline void scan_script_regfree() attribute((always_inline));
 static inline void scan_script_regfree()
 {
+    if (!lsb_regex)
+	return;
     regfree(&reg.prov);
     regfree(&reg.req_start);
     regfree(&reg.req_stop);
@@ -2142,42 +3716,18 @@ static void scan_conf_file(const char *restrict file)
 		    }
 		}
 		if (!r_list) {
-		    faci_t *restrict this;
-		    if (posix_memalign((void*)&this, sizeof(void*), alignof(faci_t)) != 0)
-			error("%s", strerror(errno));
-		    else {
-			r_list = &this->replace;
-			initial(r_list);
-			insert(&this->list, sysfaci_start->prev);
-			this->name = xstrdup(virt);
-		    }
+		    faci_t *restrict this = (faci_t*)arena_alloc(alignof(faci_t));
+		    r_list = &this->replace;
+		    initial(r_list);
+		    insert(&this->list, sysfaci_start->prev);
+		    this->name = intern(virt);
 		}
 		if(real) {
 		    char *token;
 		    while ((token = strsep(&real, delimeter))) {
-			repl_t *restrict subst;
-			string_t *r = (string_t*)0;
-			if (posix_memalign((void*)&subst, sizeof(void*), alignof(repl_t)) != 0)
-			    error("%s", strerror(errno));
+			repl_t *restrict subst = (repl_t*)pool_get(&pool_repl);
 			insert(&subst->r_list, r_list->prev);
-			subst->flags = 0;
-			list_for_each(ptr, facistr_start) {
-			    if (strcmp(getfstr(ptr)->name, token) == 0) {
-				r = getfstr(ptr);
-				break;
-			    }
-			}
-			if (!r) {
-			    if (posix_memalign((void*)&r, sizeof(void*), alignof(string_t)+strsize(token)) != 0)
-				error("%s", strerror(errno));
-			    r->ref = 1;
-			    insert(&r->s_list, facistr_start);
-			    r->name = ((char*)r)+alignof(string_t);
-			    strcpy(r->name, token);
-			} else
-			    r->ref++;
-			subst->addr = r;
-			subst->name = r->name;
+			subst->name = intern(token);
 		    }
 		}
 	    }
@@ -2367,23 +3917,17 @@ static void import_systemd_facilities(void)
 	    }
 	}
 	if (!r_list) {
-	    faci_t *restrict this;
-	    if (posix_memalign((void*)&this, sizeof(void*), alignof(faci_t)) != 0)
-		error("%s", strerror(errno));
-	    else {
-		r_list = &this->replace;
-		initial(r_list);
-		insert(&this->list, sysfaci_start->prev);
-		this->name = xstrdup(facilitiy);
-	    }
+	    faci_t *restrict this = (faci_t*)arena_alloc(alignof(faci_t));
+	    r_list = &this->replace;
+	    initial(r_list);
+	    insert(&this->list, sysfaci_start->prev);
+	    this->name = intern(facilitiy);
 	}
 
 	np_list_for_each(iptr, &sdserv->a_list) {
 	    ally_t *ally = list_entry(iptr, ally_t, a_list);
 	    repl_t *restrict subst;
-	    string_t *r = (string_t*)0;
 	    const char *token;
-	    list_t *fptr;
 
 	    if (ally->flags & SDREL_CONFLICTS)
 		continue;
@@ -2398,27 +3942,9 @@ static void import_systemd_facilities(void)
 		}
 	    }
 
-	    if (posix_memalign((void*)&subst, sizeof(void*), alignof(repl_t)) != 0)
-		error("%s", strerror(errno));
+	    subst = (repl_t*)pool_get(&pool_repl);
 	    insert(&subst->r_list, r_list->prev);
-	    subst->flags = 0;
-	    np_list_for_each(fptr, facistr_start) {
-		if (strcmp(getfstr(fptr)->name, token) == 0) {
-		    r = getfstr(fptr);
-		    break;
-		}
-	    }
-	    if (!r) {
-		if (posix_memalign((void*)&r, sizeof(void*), alignof(string_t)+strsize(token)) != 0)
-		    error("%s", strerror(errno));
-		r->ref = 1;
-		insert(&r->s_list, facistr_start);
-		r->name = ((char*)r)+alignof(string_t);
-		strcpy(r->name, token);
-	    } else
-		    r->ref++;
-	    subst->addr = r;
-	    subst->name = r->name;
+	    subst->name = intern(token);
 	}
     }
 }
@@ -2506,13 +4032,9 @@ static void expand_faci(list_t *restrict rlist, list_t *restrict head, int *rest
 	    rnxt->flags &= ~0x0001;
 	    (*deep)--;
 	} else if (*deep >= 0) {
-	    repl_t *restrict subst;
-	    if (posix_memalign((void*)&subst, sizeof(void*), alignof(repl_t)) != 0)
-		error("%s", strerror(errno));
+	    repl_t *restrict subst = (repl_t*)pool_get(&pool_repl);
 	    insert(&subst->r_list, head->prev);
-	    subst->addr = rnxt->addr;
 	    subst->name = rnxt->name;
-	    subst->addr->ref++;
 	}
     }
 out:
@@ -2530,45 +4052,114 @@ static inline void expand_conf(void)
 		int deep = 0;
 		expand_faci(rlist, head, &deep);
 		delete(rlist);
-		if (--(tmp->addr->ref) <= 0)
-		    free(tmp->addr);
-		free(tmp);
+		pool_put(&pool_repl, tmp);
 	    }
 	}
     }
 }
 
 /*
- * Scan for a Start or Kill script within a runlevel directory.
- * We start where we leave the directory, the upper level
- * has to call rewinddir(3) if necessary.
+ * The start and kill links of a runlevel directory, read once
+ * by readdir(3) and indexed by the name of the script.  The map
+ * follows all links removed or added afterwards.
+ */
+typedef struct rcmap_struct {
+    hash_t		   index;	/* Scripts by their names */
+    list_t		 scripts;	/* All scripts found */
+} rcmap_t;
+
+typedef struct rcscript_struct {
+    list_t		  r_list;	/* The peg into the list of scripts */
+    list_t		   links;	/* The links to this script */
+    char		  * name;
+} rcscript_t;
+#define getrcscript(list)	list_entry((list), rcscript_t, r_list)
+
+typedef struct rclink_struct {
+    list_t		  l_list;	/* The peg into the links of one script */
+    char		  * name;	/* Name of the link like S20network */
+} rclink_t;
+#define getrclink(list)		list_entry((list), rclink_t, l_list)
+
+/*
+ * Find the links of a script, add an empty entry if not known yet.
  */
-static inline char * scan_for(DIR *const restrict rcdir,
-			      const char *const restrict script,
-			      const char type) attribute((always_inline,nonnull(1,2)));
-static inline char * scan_for(DIR *const rcdir,
-			      const char *const script, const char type)
+static rcscript_t * rcmap_script(rcmap_t *restrict const map, const char *restrict const script) attribute((nonnull(1,2)));
+static rcscript_t * rcmap_script(rcmap_t *restrict const map, const char *restrict const script)
 {
-    struct dirent *d;
-    char * ret = (char*)0;
+    rcscript_t *restrict this = (rcscript_t*)hash_get(&map->index, script);
 
-    while ((d = readdir(rcdir)) != (struct dirent*)0) {
-	char * ptr = d->d_name;
+    if (this)
+	goto out;
 
-	if (*ptr != type)
-	    continue;
-	ptr++;
+    if (posix_memalign((void*)&this, sizeof(void*), alignof(rcscript_t)+strsize(script)) != 0)
+	error("%s", strerror(errno));
+    memset(this, 0, alignof(rcscript_t));
+    this->name = ((char*)this)+alignof(rcscript_t);
+    strcpy(this->name, script);
+    initial(&this->links);
+    insert(&this->r_list, map->scripts.prev);
+    *hash_put(&map->index, this->name) = (void*)this;
+out:
+    return this;
+}
 
-	if (strspn(ptr, "0123456789") < 2)
-	    continue;
-	ptr += 2;
+/*
+ * Add a link to the links of a script.
+ */
+static void rcmap_link(rcscript_t *restrict const script, const char *restrict const name) attribute((nonnull(1,2)));
+static void rcmap_link(rcscript_t *restrict const script, const char *restrict const name)
+{
+    rclink_t *restrict link;
 
-	if (!strcmp(ptr, script)) {
-	    ret = d->d_name;
-	    break;
+    if (posix_memalign((void*)&link, sizeof(void*), alignof(rclink_t)+strsize(name)) != 0)
+	error("%s", strerror(errno));
+    link->name = ((char*)link)+alignof(rclink_t);
+    strcpy(link->name, name);
+    insert(&link->l_list, script->links.prev);
+}
+
+/*
+ * Add a link found in the runlevel directory to the map, the
+ * same rules as for the start and kill links are used: [KS]
+ * followed by at least two digits and the name of the script.
+ */
+static inline void rcmap_add(rcmap_t *restrict const map, const char *restrict const name) attribute((always_inline,nonnull(1,2)));
+static inline void rcmap_add(rcmap_t *restrict const map, const char *restrict const name)
+{
+    if (*name != 'S' && *name != 'K')
+	return;
+    if (strspn(name+1, "0123456789") < 2)
+	return;
+    rcmap_link(rcmap_script(map, name+3), name);
+}
+
+/*
+ * Remove a link or add a new link within the runlevel directory
+ * and its map.  Nothing changes on a dry run, so does the map.
+ */
+#define rcremove(d,l)		(__extension__ ({ xremove(d,(l)->name); \
+	if (!dryrun) { delete(&(l)->l_list); free(l); } }))
+#define rcsymlink(d,x,y,s)	(__extension__ ({ xsymlink(d,x,y); \
+	if (!dryrun) rcmap_link(s,y); }))
+
+static void rcmap_free(rcmap_t *restrict const map) attribute((nonnull(1),unused));
+static void rcmap_free(rcmap_t *restrict const map)
+{
+    list_t * ptr, * safe;
+
+    list_for_each_safe(ptr, safe, &map->scripts) {
+	rcscript_t * script = getrcscript(ptr);
+	list_t * lptr, * lsafe;
+
+	list_for_each_safe(lptr, lsafe, &script->links) {
+	    delete(lptr);
+	    free(getrclink(lptr));
 	}
+	delete(ptr);
+	free(script);
     }
-    return ret;
+    hash_free(&map->index);
 }
 
 #ifdef SUSE
@@ -2669,17 +4260,28 @@ out:
 #ifdef WANT_SYSTEMD
 
 /*
- * Systemd integration
+ * Systemd integration, the services of systemd are read once
+ * into a set on the first check.
  */
+static hash_t sdshadows;
+static boolean sdshadows_read = false;
+
 static boolean is_overridden_by_systemd(const char *service) {
+    if (!sdshadows_read) {
+	systemd_read_shadows(root, &sdshadows);
+	sdshadows_read = true;
+    }
+    return (hash_get(&sdshadows, service) != (void*)0);
+}
+
+static boolean systemd_binary(void)
+{
     char *p;
-    boolean ret = false;
+    boolean ret;
 
-    if (asprintf(&p, SYSTEMD_SERVICE_PATH "/%s.service", service) < 0)
+    if (asprintf(&p, "%s" SYSTEMD_BINARY_PATH, root ? root : "") < 0)
 	error("asprintf(): %s\n", strerror(errno));
-
-    if (access(p, F_OK) >= 0)
-	ret = true;
+    ret = (access(p, F_OK) == 0);
     free(p);
     return ret;
 }
@@ -2750,6 +4352,187 @@ boolean Start_Stop_Overlap(char *start_levels, char *stop_levels)
 }
 
 
+/*
+ * Read the operations of a batch transaction from file, or from the
+ * standard input if file is `-'.  Each line is one of
+ *
+ *   enable <script> [<arguments>]
+ *   remove <script>
+ *
+ * Empty lines and lines starting with `#' are skipped.  The scripts
+ * are given back as an argument list together with their arguments
+ * and the flags for the scripts to remove.  A later line for a script
+ * overwrites a former one.
+ */
+static char * batch_data;
+static int batch_load(const char *restrict const file, char ***restrict const argv,
+		      char ***restrict const argr, boolean **restrict const argd) attribute((nonnull(1,2,3,4)));
+static int batch_load(const char *restrict const file, char ***restrict const argv,
+		      char ***restrict const argr, boolean **restrict const argd)
+{
+    FILE * fp = stdin;
+    size_t len = 0, size = 0;
+    int count = 0, max = 0, num = 0;
+    char * line, * next;
+
+    if (strcmp(file, "-") && !(fp = fopen(file, "r")))
+	error("can not open %s: %s\n", file, strerror(errno));
+    do {
+	if (len == size) {
+	    size += BUFSIZ;
+	    if (!(batch_data = (char*)realloc(batch_data, size + 1)))
+		error("%s", strerror(errno));
+	}
+	len += fread(batch_data + len, 1, size - len, fp);
+    } while (len == size);
+    if (ferror(fp))
+	error("can not read %s: %s\n", file, strerror(errno));
+    if (fp != stdin)
+	fclose(fp);
+    batch_data[len] = '\0';
+
+    /* The operations are part of the command line */
+    snapshot_args = fnv(snapshot_args, batch_data, len);
+
+    *argv = (char**)0;
+    *argr = (char**)0;
+    *argd = (boolean*)0;
+
+    for (line = batch_data; line; line = next) {
+	char * op, * name, * args;
+	boolean del;
+	int c;
+
+	num++;
+	if ((next = strchr(line, '\n')))
+	    *next++ = '\0';
+	line += strspn(line, delimeter);
+	if (*line == '\0' || *line == '#')
+	    continue;
+
+	op = strsep(&line, delimeter);
+	if (!line || *(name = line + strspn(line, delimeter)) == '\0')
+	    error("%s:%d: no script given\n", file, num);
+	if ((args = strpbrk(name, delimeter))) {
+	    *args++ = '\0';
+	    args += strspn(args, delimeter);
+	    if (*args == '\0')
+		args = (char*)0;
+	}
+
+	if (!strcmp(op, "enable"))
+	    del = false;
+	else if (!strcmp(op, "remove")) {
+	    if (args)
+		error("%s:%d: no arguments for remove\n", file, num);
+	    del = true;
+	} else
+	    error("%s:%d: unknown operation `%s'\n", file, num, op);
+
+	for (c = 0; c < count; c++)
+	    if (!strcmp((*argv)[c], name))
+		break;
+	if (c == count) {
+	    if (count + 1 >= max) {
+		max += 64;
+		if (!(*argv = (char**)realloc(*argv, max * sizeof(char*))) ||
+		    !(*argr = (char**)realloc(*argr, max * sizeof(char*))) ||
+		    !(*argd = (boolean*)realloc(*argd, max * sizeof(boolean))))
+		    error("%s", strerror(errno));
+	    }
+	    count++;
+	}
+	(*argv)[c] = name;
+	(*argr)[c] = args;
+	(*argd)[c] = del;
+    }
+
+    if (max == 0) {
+	if (!(*argv = (char**)calloc(1, sizeof(char*))) ||
+	    !(*argr = (char**)calloc(1, sizeof(char*))) ||
+	    !(*argd = (boolean*)calloc(1, sizeof(boolean))))
+	    error("%s", strerror(errno));
+    }
+    (*argv)[count] = (char*)0;
+    return count;
+}
+
+/*
+ * The queue of deferred operations, the lines are those of a batch
+ * file.  The queue is locked while an operation is added or while
+ * the queue is done with --flush.
+ */
+static int queue_fd = -1;
+static void queue_add(const int argc, char *const argv[], char *const argr[],
+		      const boolean argd[]) attribute((nonnull(2,3,4)));
+static void queue_add(const int argc, char *const argv[], char *const argr[],
+		      const boolean argd[])
+{
+    char file[PATH_MAX+1];
+    FILE * queue;
+    int fd, c;
+
+    snprintf(file, sizeof(file), "%s" QUEUE_FILE, dependency_path);
+    if (dryrun) {
+	for (c = 0; c < argc; c++)
+	    info(1, "dryrun, not deferring %s of %s to %s\n", argd[c] ? "removal" : "enabling", argv[c], file);
+	return;
+    }
+    if ((fd = open(file, O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0644)) < 0)
+	error("can not open %s: %s\n", file, strerror(errno));
+    if (flock(fd, LOCK_EX) < 0)
+	error("can not lock %s: %s\n", file, strerror(errno));
+    if (!(queue = fdopen(fd, "a")))
+	error("%s", strerror(errno));
+
+    for (c = 0; c < argc; c++) {
+	if (argd[c])
+	    fprintf(queue, "remove %s\n", argv[c]);
+	else if (argr[c])
+	    fprintf(queue, "enable %s %s\n", argv[c], argr[c]);
+	else
+	    fprintf(queue, "enable %s\n", argv[c]);
+    }
+    if (fclose(queue))
+	error("can not write %s: %s\n", file, strerror(errno));
+    info(1, "deferred %d operations to %s\n", argc, file);
+}
+
+/*
+ * Lock the queue for --flush, on a dry run the queue is neither
+ * created nor emptied later on.  Returns false if there is no queue.
+ */
+static boolean queue_lock(const char *restrict const file) attribute((nonnull(1)));
+static boolean queue_lock(const char *restrict const file)
+{
+    if (dryrun)
+	queue_fd = open(file, O_RDONLY|O_CLOEXEC);
+    else
+	queue_fd = open(file, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+    if (queue_fd < 0) {
+	if (dryrun && errno == ENOENT)
+	    return false;
+	error("can not open %s: %s\n", file, strerror(errno));
+    }
+    if (flock(queue_fd, dryrun ? LOCK_SH : LOCK_EX) < 0)
+	error("can not lock %s: %s\n", file, strerror(errno));
+    return true;
+}
+
+/*
+ * All operations of the queue are done, empty the queue but keep
+ * the file as others may already wait for the lock on it.
+ */
+static void queue_done(const boolean empty)
+{
+    if (queue_fd < 0)
+	return;
+    if (empty && ftruncate(queue_fd, 0) < 0)
+	warn("can not empty queue: %s\n", strerror(errno));
+    close(queue_fd);
+    queue_fd = -1;
+}
+
 static struct option long_options[] =
 {
     {"verbose",	    0, (int*)0, 'v'},
@@ -2767,6 +4550,19 @@ static struct option long_options[] =
     {"recursive",   0, (int*)0, 'e'},
     {"showall",	    0, (int*)0, 's'},
     {"show-all",    0, (int*)0, 's'},
+    {"regex-parser", 0, (int*)0, 'R'},
+    {"order-engine", 1, (int*)0, 'O'},
+    {"stats",	    0, (int*)0, 'S'},
+    {"jobs",	    1, (int*)0, 'j'},
+    {"io-uring",    0, (int*)0, 'U'},
+    {"incremental", 0, (int*)0, 'I'},
+    {"verify-incremental", 0, (int*)0, 'V'},
+    {"batch",	    1, (int*)0, 'b'},
+    {"defer",	    0, (int*)0, 'D'},
+    {"flush",	    0, (int*)0, 'F'},
+#ifdef WANT_SYSTEMD_DBUS
+    {"dbus-timeout", 1, (int*)0, 'T'},
+#endif /* WANT_SYSTEMD_DBUS */
     {"help",	    0, (int*)0, 'h'},
     { 0,	    0, (int*)0,  0 },
 };
@@ -2790,20 +4586,37 @@ static void help(const char *restrict const  name)
     printf("  -u <path>, --upstart-job <path> Path to replace existing upstart job path.\n");
     printf("  -e, --recursive  Expand and enable all required services.\n");
     printf("  -d, --default    Use default runlevels a defined in the scripts\n");
+    printf("  --regex-parser   Parse LSB headers with regular expressions.\n");
+    printf("  --order-engine <legacy|linear>  Algorithm used to calculate the order.\n");
+    printf("  --stats          Print time spent and system calls done on stderr.\n");
+    printf("  -j <n>, --jobs <n>  Scan the LSB headers with n threads.\n");
+    printf("  --io-uring       Read the LSB headers with batches of io_uring requests.\n");
+    printf("  --incremental    Order only the services changed since the last run.\n");
+    printf("  --verify-incremental  Check the incremental order against the full order.\n");
+    printf("  --batch <file>   Enable and remove the scripts listed in file at once.\n");
+    printf("  --defer          Only queue the operation, see --flush.\n");
+    printf("  --flush          Do all queued operations at once.\n");
+#ifdef WANT_SYSTEMD_DBUS
+    printf("  --dbus-timeout <s>  Wait at most s seconds for the units of systemd.\n");
+#endif /* WANT_SYSTEMD_DBUS */
 }
 
 
 /*
  * Do the job.
  */
-int main (int argc, char *argv[])
+static int insserv(int argc, char *argv[])
 {
     DIR * initdir;
     struct dirent *d;
     struct stat st_script;
-    /* extension char * argr[argc]; */
-    char * argr[argc]; 
+    char ** argr;
+    boolean * argd;
     char * path = INITDIR;
+    char * batch = (char*)0;
+    char queue_file[PATH_MAX+1];
+    boolean defer = false;
+    boolean flush = false;
     char * override_path = OVERRIDEDIR;
     char * insconf = INSCONF;
     const char *const ipath = path;
@@ -2818,6 +4631,8 @@ int main (int argc, char *argv[])
     /* boolean legacy_path = false; */
     boolean free_dependency_path = false;
     boolean overlap;
+    boolean snapshot = false;
+    char order_file[PATH_MAX+1];
 
     myname = basename(*argv);
 
@@ -2829,10 +4644,9 @@ int main (int argc, char *argv[])
     if (getuid() == (uid_t)0)
 	o_flags |= O_NOATIME;
 
-    for (c = 0; c < argc; c++)
-	argr[c] = (char*)0;
+    snapshot_cmdline(argc, argv);
 
-    while ((c = getopt_long(argc, argv, "c:dfrhvni:o:p:u:es", long_options, (int *)0)) != -1) {
+    while ((c = getopt_long(argc, argv, "c:dfrhvni:o:p:u:esj:", long_options, (int *)0)) != -1) {
 	size_t l;
 	switch (c) {
 	    case 'c':
@@ -2906,6 +4720,52 @@ int main (int argc, char *argv[])
 	    case 'e':
 		recursive = true;
 		break;
+	    case 'R':
+		lsb_regex = true;
+		break;
+	    case 'O':
+		if (optarg == (char*)0 || *optarg == '\0')
+		    goto err;
+		if (!strcmp(optarg, "linear"))
+		    linear_order = true;
+		else if (!strcmp(optarg, "legacy"))
+		    linear_order = false;
+		else
+		    goto err;
+		break;
+	    case 'S':
+		stats = true;
+		break;
+	    case 'j':
+		if (optarg == (char*)0 || (jobs = atoi(optarg)) < 1)
+		    goto err;
+		break;
+	    case 'U':
+		uring = true;
+		break;
+	    case 'b':
+		if (optarg == (char*)0 || *optarg == '\0')
+		    goto err;
+		batch = optarg;
+		break;
+	    case 'D':
+		defer = true;
+		break;
+	    case 'F':
+		flush = true;
+		break;
+#ifdef WANT_SYSTEMD_DBUS
+	    case 'T':
+		if (optarg == (char*)0 || (dbus_timeout = atoi(optarg)) < 1)
+		    goto err;
+		break;
+#endif /* WANT_SYSTEMD_DBUS */
+	    case 'V':
+		verify_incremental = true;
+		/* fall through */
+	    case 'I':
+		incremental = true;
+		break;
 	    case '?':
 	    err:
 		error("For help use: %s -h\n", myname);
@@ -2919,10 +4779,51 @@ int main (int argc, char *argv[])
     argv += optind;
     argc -= optind;
 
+    /* The order cache holds the order of the linear engine */
+    if (incremental)
+	linear_order = true;
+
+    /*
+     * The queue is done like a batch file, it stays locked until
+     * all operations are done.
+     */
+    if (flush) {
+	if (argc || del || batch || defer)
+	    error("usage: %s [<options>] --flush\n", myname);
+	snprintf(queue_file, sizeof(queue_file), "%s" QUEUE_FILE, dependency_path);
+	if (queue_lock(queue_file))
+	    batch = queue_file;
+    }
+
+    /*
+     * The scripts to enable or remove are given on the command line or
+     * by the lines of a batch file.  Later lines of the batch overwrite
+     * former ones for the same script.
+     */
+    if (batch) {
+	if (argc || del)
+	    error("usage: %s [<options>] --batch <file>\n", myname);
+	argc = batch_load(batch, &argv, &argr, &argd);
+	for (c = 0, del = (argc > 0); c < argc; c++)
+	    if (!argd[c])
+		del = false;
+    } else {
+	argr = (char**)calloc(argc + 1, sizeof(char*));
+	argd = (boolean*)calloc(argc + 1, sizeof(boolean));
+	if (!argr || !argd)
+	    error("%s", strerror(errno));
+	for (c = 0; c < argc; c++)
+	    argd[c] = del;
+    }
+
     if (argc)
 	loadarg = true;
-    else if (del)
+    else if (del || defer)
 	error("usage: %s [[-r] init_script|init_directory]\n", myname);
+    else if (flush) {
+	info(1, "no deferred operations in %s\n", queue_file);
+	goto out;
+    }
 
     /* Make sure the target directory exists */
     /*
@@ -2933,7 +4834,7 @@ int main (int argc, char *argv[])
     /* load options from /etc/inssserv/ directory */
     file_filters = Load_File_Filters();
 
-    if (*argv) {
+    if (!batch && *argv) {
 	char * token = strpbrk(*argv, delimeter);
 
 	/*
@@ -3040,6 +4941,14 @@ int main (int argc, char *argv[])
 	    printf("Overwrite argument for %s is %s\n", argv[c], argr[c]);
 #endif /* DEBUG */
 
+    /*
+     * Nothing more to do now, the operations are done by --flush
+     */
+    if (defer) {
+	queue_add(argc, argv, argr, argd);
+	goto out;
+    }
+
 #ifdef SUSE
     if (!underrpm())
 #endif
@@ -3047,20 +4956,47 @@ int main (int argc, char *argv[])
      * Systemd support
      */
 #ifdef WANT_SYSTEMD
-    if (access(SYSTEMD_BINARY_PATH, F_OK) == 0 && (sbus = systemd_open_conn())) {
+    if (systemd_binary()) {
 
 	for (c = 0; c < argc; c++)
-	    forward_to_systemd (argv[c], del ? "disable": "enable", path != ipath);
+	    forward_to_systemd (argv[c], argd[c] ? "disable": "enable", path != ipath);
 
-	(void)systemd_get_tree(sbus);
-	systemd_close_conn(sbus);
+	/*
+	 * The unit files are read directly, the dbus API of systemd
+	 * is used only if wanted and only for the running system.
+	 */
+# ifdef WANT_SYSTEMD_DBUS
+	if (!root && (sbus = systemd_open_conn())) {
+	    (void)systemd_get_tree(sbus, dbus_timeout);
+	    systemd_close_conn(sbus);
+	} else
+# endif /* WANT_SYSTEMD_DBUS */
+	(void)systemd_read_tree(root);
 	systemd = true;
     }
 #endif /* WANT_SYSTEMD */
 
+    /*
+     * Nothing to do if all inputs are the same as for a former run
+     * which has changed nothing.  The units of systemd are not part
+     * of the fingerprint.
+     */
+    snapshot = !dryrun;
+#ifdef WANT_SYSTEMD
+    if (systemd)
+	snapshot = false;
+#endif /* WANT_SYSTEMD */
+    if (snapshot) {
+	stats_phase("load_snapshot");
+	snapshot_start = snapshot_fingerprint(path, override_path, insconf);
+	if (snapshot_load())
+	    goto out;
+    }
+
     /*
      * Scan and set our configuration for virtual services.
      */
+    stats_phase("scan_conf");
     scan_conf(insconf);
 
 #ifdef WANT_SYSTEMD
@@ -3074,6 +5010,7 @@ int main (int argc, char *argv[])
     /*
      * Expand system facilities to real services
      */
+    stats_phase("expand_conf");
     expand_conf();
 
 #ifdef WANT_SYSTEMD
@@ -3087,24 +5024,36 @@ int main (int argc, char *argv[])
 #endif
 
     /*
-     * Initialize the regular scanner for the scripts.
+     * Initialize the regular scanner for the scripts
+     * and load the results of former runs.
      */
+    stats_phase("load_cache");
     scan_script_regalloc();
+    lsbcache_load();
 
     /*
      * Scan always for the runlevel links to see the current
      * link scheme of the services.
      */
+    if (jobs > 1 || uring) {
+	stats_phase("scan_threads");
+	lsbjob_start(path, override_path, jobs);
+    }
+
+    stats_phase("scan_script_locations");
     scan_script_locations(path, override_path, ignore);
 
     /*
      * Clear out aliases found for scripts found up to this point.
      */
+    stats_phase("clear_all");
     clear_all();
 
     /*
      * Open the script directory
      */
+    stats_phase("scan_initd");
+    stats_add(CNT_OPEN, 1);
     if ((initdir = opendir(path)) == (DIR*)0 || (dfd = dirfd(initdir)) < 0)
 	error("can not opendir(%s): %s\n", path, strerror(errno));
 
@@ -3160,6 +5109,8 @@ int main (int argc, char *argv[])
 		first = service;
 
 	    service->attr.flags |= SERV_CMDLINE;
+	    if (argd[c])
+		service->attr.flags |= SERV_REMOVE;
 	}
 	free(provides);
     }
@@ -3173,6 +5124,7 @@ int main (int argc, char *argv[])
 	char * begin = (char*)0;	/* hold start pointer of strings handled by strsep() */
 	boolean hard = false;
 	boolean isarg = false;
+	boolean rem = del;
 	uchar lsb = 0;
 #if defined(DEBUG) && (DEBUG > 0)
 	int nobug = 0;
@@ -3193,6 +5145,8 @@ int main (int argc, char *argv[])
 	}
 
 	isarg = chkfor(d->d_name, argv, argc);
+	if (isarg)
+	    rem = argd[curr_argc];
 
 	/*
 	 * Load first script in argument list before all other scripts. This
@@ -3507,15 +5461,15 @@ int main (int argc, char *argv[])
 #endif
 		if (!makeprov(service, d->d_name)) {
 
-		    if (!del || (del && !isarg))
+		    if (!rem || (rem && !isarg))
 			warn("script %s: service %s already provided!\n", d->d_name, token);
 
-		    if (!del && !ignore && isarg) {
+		    if (!rem && !ignore && isarg) {
 			waserr = true;
 			continue;
 		    }
 
-		    if (!del || (del && !ignore && !isarg))
+		    if (!rem || (rem && !ignore && !isarg))
 			continue;
 
 		    /* Provide this service with an other name to be able to delete it */
@@ -3573,7 +5527,7 @@ int main (int argc, char *argv[])
 		     */
 		    if (isarg && !ignore) {
 			boolean ok = true;
-			if (del)
+			if (rem)
 			    ok = chkdependencies(service);
 			else
 			    ok = chkrequired(service, recursive);
@@ -3592,7 +5546,7 @@ int main (int argc, char *argv[])
 			     * of the current script.
 			     */
 			    if (!defaults && (deflvls != service->start->lvl)) {
-				if (!del && isarg && !(argr[curr_argc]))
+				if (!rem && isarg && !(argr[curr_argc]))
                                 {
 				    warn("warning: current start runlevel(s) (%s) of script `%s' overrides LSB defaults (%s).\n",
                                            service->start->lvl ? lvl2str(service->start->lvl) :
@@ -3615,7 +5569,7 @@ int main (int argc, char *argv[])
 			     * of the current script.
 			     */
 			    if (!defaults && service->start->lvl != 0) {
-				if (!del && isarg && !(argr[curr_argc]))
+				if (!rem && isarg && !(argr[curr_argc]))
 				    warn("warning: current start runlevel(s) (%s) of script `%s' overrides LSB defaults (empty).\n",
 					 lvl2str(service->start->lvl), d->d_name);
 				script_inf.default_start = lvl2str(service->start->lvl);
@@ -3658,7 +5612,7 @@ int main (int argc, char *argv[])
 			     * if the defaults are overwriten.
 			     */
 			    if (!defaults && (deflvlk != service->stopp->lvl)) {
-				if (!del && isarg && !(argr[curr_argc]))
+				if (!rem && isarg && !(argr[curr_argc]))
 				    warn("warning: current stop runlevel(s) (%s) of script `%s' overrides LSB defaults (%s).\n",
 					 service->stopp->lvl ? lvl2str(service->stopp->lvl) : "empty", d->d_name, lvl2str(deflvlk));
 			    }
@@ -3678,7 +5632,7 @@ int main (int argc, char *argv[])
 			     * of the current script.
 			     */
 			    if (!defaults && service->stopp->lvl != 0) {
-				if (!del && isarg && !(argr[curr_argc]))
+				if (!rem && isarg && !(argr[curr_argc]))
 				    warn("warning: current stop runlevel(s) (%s) of script `%s' overrides LSB defaults (empty).\n",
 					 lvl2str(service->stopp->lvl), d->d_name);
 				script_inf.default_stop = lvl2str(service->stopp->lvl);
@@ -3740,7 +5694,7 @@ int main (int argc, char *argv[])
                   d->d_name, script_inf.default_start, script_inf.default_stop);
         }
 
-	if (isarg && !defaults && !del) {
+	if (isarg && !defaults && !rem) {
 	    if (argr[curr_argc]) {
 		char * ptr = argr[curr_argc];
 		struct _mark {
@@ -3821,7 +5775,7 @@ int main (int argc, char *argv[])
 	    service = getorig(service);
 
 	    if ((service->attr.flags & SERV_ENABLED) && !hard) {
-		if (del)
+		if (rem)
 		    continue;
 		if (!defaults)
 		    continue;
@@ -3847,6 +5801,7 @@ int main (int argc, char *argv[])
      * Free the regular scanner for the scripts.
      */
     scan_script_regfree();
+    lsbjob_free();
 
     /* back */
     popd();
@@ -3855,29 +5810,57 @@ int main (int argc, char *argv[])
     /*
      * Clear out aliases found for all scripts.
      */
+    stats_phase("clear_all");
     clear_all();
 
     /*
      * Set virtual dependencies for already enabled none LSB scripts.
      */
+    stats_phase("nonlsb_script");
     nonlsb_script();
 
     /*
      * Handle the `$all' scripts
      */
+    stats_phase("all_script");
     all_script();
 
+    /*
+     * The graph is complete, pack it for the orderings
+     */
+    stats_phase("freeze");
+    freeze();
+
+    /*
+     * Fail early if there are loops in the dependencies
+     */
+    stats_phase("detect_loops");
+    if (detect_loops() && !ignore)
+	error("exiting now without changing boot order!\n");
+
     /*
      * Now generate for all scripts the dependencies
      */
-    follow_all();
+    stats_phase("follow_all");
+    if (incremental) {
+	snprintf(order_file, sizeof(order_file), "%s" ORDER_FILE, dependency_path);
+	follow_all(order_file, verify_incremental);
+    } else
+	follow_all((char*)0, false);
     if (is_loop_detected() && !ignore)
 	error("exiting now without changing boot order!\n");
 
+    if (incremental) {
+	stats_phase("save_order");
+	if (!dryrun)
+	    save_order(order_file);
+    }
+
     /*
      * Be sure that interactive scripts are the only member of
      * a start group (for parallel start only).
      */
+    stats_phase("active_script");
     active_script();
 
     /*
@@ -3895,7 +5878,7 @@ int main (int argc, char *argv[])
 	    if (list_empty(&cur->sort.req))
 		continue;
 
-	    if (cur->attr.flags & SERV_SYSTEMD)
+	    if (cur->attr.flags & (SERV_SYSTEMD|SERV_REMOVE))
 		continue;
 
 	    np_list_for_each(pos, &cur->sort.req) {
@@ -4012,6 +5995,7 @@ int main (int argc, char *argv[])
     if (showall)
 	show_all();
 
+    stats_phase("links");
 #if defined(DEBUG) && (DEBUG > 0)
     printf("Maxorder %d/%d\n", maxstart, maxstop);
     show_all();
@@ -4024,6 +6008,7 @@ int main (int argc, char *argv[])
 	const char * rcd = (char*)0;
 	const char * script;
 	service_t *serv;
+	rcmap_t rcmap;
 	DIR  * rcdir;
 
 	if ((rcd = map_runlevel_to_location(runlevel)) == (char*)0)
@@ -4038,12 +6023,16 @@ int main (int argc, char *argv[])
 	}
 	pushd(rcd);
 
+	memset(&rcmap, 0, sizeof(rcmap));
+	initial(&rcmap.scripts);
+
 	/*
 	 * See if we found scripts which should not be
 	 * included within this runlevel directory.
 	 */
 	while ((d = readdir(rcdir)) != (struct dirent*)0) {
 	    const char * ptr = d->d_name;
+	    boolean gone = false;
 	    char type;
 
 	    if (*ptr != 'S' && *ptr != 'K')
@@ -4052,30 +6041,38 @@ int main (int argc, char *argv[])
 	    ptr++;
 
 	    if (strspn(ptr, "0123456789") != 2)
-		continue;
+		goto keep;
 	    ptr += 2;
 
-	    if (xstat(dfd, d->d_name, &st_script) < 0)
+	    if (xstat(dfd, d->d_name, &st_script) < 0) {
 		xremove(dfd, d->d_name);	/* dangling sym link */
+		gone = true;
+	    }
 
 	    if (notincluded(ptr, type, runlevel)) {
 		serv = findservice(getprovides(ptr));
 		if (defaults) {
 		    xremove(dfd, d->d_name);
+		    gone = true;
 		    if (serv && --serv->attr.ref <= 0)
 			serv->attr.flags &= ~SERV_ENABLED;
 		} else if (lvl & LVL_ONEWAY) {
 		    xremove(dfd, d->d_name);
+		    gone = true;
 		    if (serv && --serv->attr.ref <= 0)
 			serv->attr.flags &= ~SERV_ENABLED;
-		} else if (del && ignore) {
+		} else if (ignore) {
 		    if (serv && (serv->attr.flags & SERV_ALREADY)) {
 			xremove(dfd, d->d_name);
+			gone = true;
 			if (--serv->attr.ref <= 0)
 			    serv->attr.flags &= ~SERV_ENABLED;
 		    }
 		}
 	    }
+	keep:
+	    if (!gone || dryrun)
+		rcmap_add(&rcmap, d->d_name);
 	}
 
 	/*
@@ -4086,8 +6083,10 @@ int main (int argc, char *argv[])
 	script = (char*)0;
 	while ((serv = listscripts(&script, 'X', lvl))) {
 	    boolean this = chkfor(script, argv, argc);
+	    boolean rem = this && argd[curr_argc];
 	    boolean found, slink;
-	    char * clink;
+	    list_t * ptr, * safe;
+	    rcscript_t * rcs;
 
 	    if (*script == '$')		/* Do not link in virtual dependencies */
 		continue;
@@ -4103,26 +6102,29 @@ int main (int argc, char *argv[])
 	    sprintf(nlink, "S%.2d%s", serv->attr.sorder, script);
 
 	    found = false;
-	    rewinddir(rcdir);
-	    while ((clink = scan_for(rcdir, script, 'S'))) {
+	    rcs = rcmap_script(&rcmap, script);
+	    list_for_each_safe(ptr, safe, &rcs->links) {
+		rclink_t * clink = getrclink(ptr);
+		if (*clink->name != 'S')
+		    continue;
 		found = true;
-		if (strcmp(clink, nlink)) {
-		    xremove(dfd, clink);		/* Wrong order, remove link */
+		if (strcmp(clink->name, nlink)) {
+		    rcremove(dfd, clink);		/* Wrong order, remove link */
 		    if (--serv->attr.ref <= 0)
 			serv->attr.flags &= ~SERV_ENABLED;
 		    if (!this) {
-			xsymlink(dfd, olink, nlink);	/* Not ours, but correct order */
+			rcsymlink(dfd, olink, nlink, rcs);	/* Not ours, but correct order */
 			if (++serv->attr.ref)
 			    serv->attr.flags |= SERV_ENABLED;
 		    }
-		    if (this && !del) {
-			xsymlink(dfd, olink, nlink);	/* Restore, with correct order */
+		    if (this && !rem) {
+			rcsymlink(dfd, olink, nlink, rcs);	/* Restore, with correct order */
 			if (++serv->attr.ref)
 			    serv->attr.flags |= SERV_ENABLED;
 		    }
 		} else {
-		    if (del && this) {
-			xremove(dfd, clink);		/* Found it, remove link */
+		    if (rem && this) {
+			rcremove(dfd, clink);		/* Found it, remove link */
 			if (--serv->attr.ref <= 0)
 			    serv->attr.flags &= ~SERV_ENABLED;
 		    }
@@ -4134,8 +6136,8 @@ int main (int argc, char *argv[])
 		 * If we haven't found it and we shouldn't delete it
 		 * we try to add it.
 		 */
-		if (!del && !found) {
-		    xsymlink(dfd, olink, nlink);
+		if (!rem && !found) {
+		    rcsymlink(dfd, olink, nlink, rcs);
 		    if (++serv->attr.ref)
 			serv->attr.flags |= SERV_ENABLED;
 		    found = true;
@@ -4153,26 +6155,29 @@ int main (int argc, char *argv[])
 	    sprintf(nlink, "K%.2d%s", serv->attr.korder, script);
 
 	    found = false;
-	    rewinddir(rcdir);
-	    while ((clink = scan_for(rcdir, script, 'K'))) {
+	    rcs = rcmap_script(&rcmap, script);
+	    list_for_each_safe(ptr, safe, &rcs->links) {
+		rclink_t * clink = getrclink(ptr);
+		if (*clink->name != 'K')
+		    continue;
 		found = true;
-		if (strcmp(clink, nlink)) {
-		    xremove(dfd, clink);		/* Wrong order, remove link */
+		if (strcmp(clink->name, nlink)) {
+		    rcremove(dfd, clink);		/* Wrong order, remove link */
 		    if (--serv->attr.ref <= 0)
 			serv->attr.flags &= ~SERV_ENABLED;
 		    if (!this) {
-			xsymlink(dfd, olink, nlink);	/* Not ours, but correct order */
+			rcsymlink(dfd, olink, nlink, rcs);	/* Not ours, but correct order */
 			if (++serv->attr.ref)
 			    serv->attr.flags |= SERV_ENABLED;
 		    }
-		    if (this && !del) {
-			xsymlink(dfd, olink, nlink);	/* Restore, with correct order */
+		    if (this && !rem) {
+			rcsymlink(dfd, olink, nlink, rcs);	/* Restore, with correct order */
 			if (++serv->attr.ref)
 			    serv->attr.flags |= SERV_ENABLED;
 		    }
 		} else {
-		    if (del && this) {
-			xremove(dfd, clink);		/* Found it, remove link */
+		    if (rem && this) {
+			rcremove(dfd, clink);		/* Found it, remove link */
 			if (--serv->attr.ref <= 0)
 			    serv->attr.flags &= ~SERV_ENABLED;
 		    }
@@ -4184,14 +6189,15 @@ int main (int argc, char *argv[])
 		 * If we haven't found it and we shouldn't delete it
 		 * we try to add it.
 		 */
-		if (!del && !found) {
-		    xsymlink(dfd, olink, nlink);
+		if (!rem && !found) {
+		    rcsymlink(dfd, olink, nlink, rcs);
 		    if (++serv->attr.ref)
 			serv->attr.flags |= SERV_ENABLED;
 		}
 	    }
 	}
 	popd();
+	rcmap_free(&rcmap);
 	closedir(rcdir);
     }
 # else  /* not SUSE but Debian SystemV link scheme */
@@ -4210,6 +6216,7 @@ int main (int argc, char *argv[])
 	const char * script;
 	service_t * serv;
 	ushort lvl, seek;
+	rcmap_t rcmap;
 	DIR  * rcdir;
 
 	if ((rcd = map_runlevel_to_location(runlevel)) == (char*)0)
@@ -4226,12 +6233,16 @@ int main (int argc, char *argv[])
 	}
 	pushd(rcd);
 
+	memset(&rcmap, 0, sizeof(rcmap));
+	initial(&rcmap.scripts);
+
 	/*
 	 * See if we found scripts which should not be
 	 * included within this runlevel directory.
 	 */
 	while ((d = readdir(rcdir)) != (struct dirent*)0) {
 	    const char * ptr = d->d_name;
+	    boolean gone = false;
 	    char type;
 
 	    if (*ptr != 'S' && *ptr != 'K')
@@ -4240,39 +6251,49 @@ int main (int argc, char *argv[])
 	    ptr++;
 
 	    if (strspn(ptr, "0123456789") != 2)
-		continue;
+		goto keep;
 	    ptr += 2;
 
-	    if (xstat(dfd, d->d_name, &st_script) < 0)
+	    if (xstat(dfd, d->d_name, &st_script) < 0) {
 		xremove(dfd, d->d_name);	/* dangling sym link */
+		gone = true;
+	    }
 
 	    if (notincluded(ptr, type, runlevel)) {
 		serv = findservice(getprovides(ptr));
 		if (defaults) {
 		    xremove(dfd, d->d_name);
+		    gone = true;
 		    if (serv && --serv->attr.ref <= 0)
 			serv->attr.flags &= ~SERV_ENABLED;
 #  ifndef USE_KILL_IN_BOOT
 		} else if (lvl & LVL_BOOT) {
 		    xremove(dfd, d->d_name);
+		    gone = true;
 		    if (serv && --serv->attr.ref <= 0)
 			serv->attr.flags &= ~SERV_ENABLED;
 #  endif /* USE_KILL_IN_BOOT */
-		} else if (del && ignore) {
+		} else if (ignore) {
 		    if (serv && (serv->attr.flags & SERV_ALREADY)) {
 			xremove(dfd, d->d_name);
+			gone = true;
 			if (--serv->attr.ref <= 0)
 			    serv->attr.flags &= ~SERV_ENABLED;
 		    }
 		}
 	    }
+	keep:
+	    if (!gone || dryrun)
+		rcmap_add(&rcmap, d->d_name);
 	}
 
 	script = (char*)0;
 	while ((serv = listscripts(&script, 'X', seek))) {
 	    boolean this = chkfor(script, argv, argc);
+	    boolean rem = this && argd[curr_argc];
 	    boolean found;
-	    char * clink;
+	    list_t * ptr, * safe;
+	    rcscript_t * rcs;
 	    char mode;
 
 	    if (*script == '$')		/* Do not link in virtual dependencies */
@@ -4297,26 +6318,29 @@ int main (int argc, char *argv[])
 
 	    found = false;
 
-	    rewinddir(rcdir);
-	    while ((clink = scan_for(rcdir, script, mode))) {
+	    rcs = rcmap_script(&rcmap, script);
+	    list_for_each_safe(ptr, safe, &rcs->links) {
+		rclink_t * clink = getrclink(ptr);
+		if (*clink->name != mode)
+		    continue;
 		found = true;
-		if (strcmp(clink, nlink)) {
-		    xremove(dfd, clink);		/* Wrong order, remove link */
+		if (strcmp(clink->name, nlink)) {
+		    rcremove(dfd, clink);		/* Wrong order, remove link */
 		    if (--serv->attr.ref <= 0)
 			serv->attr.flags &= ~SERV_ENABLED;
 		    if (!this) {
-			xsymlink(dfd, olink, nlink);	/* Not ours, but correct order */
+			rcsymlink(dfd, olink, nlink, rcs);	/* Not ours, but correct order */
 			if (++serv->attr.ref)
 			    serv->attr.flags |= SERV_ENABLED;
 		    }
-		    if (this && !del) {
-			xsymlink(dfd, olink, nlink);	/* Restore, with correct order */
+		    if (this && !rem) {
+			rcsymlink(dfd, olink, nlink, rcs);	/* Restore, with correct order */
 			if (++serv->attr.ref)
 			    serv->attr.flags |= SERV_ENABLED;
 		    }
 		} else {
-		    if (del && this) {
-			xremove(dfd, clink);		/* Found it, remove link */
+		    if (rem && this) {
+			rcremove(dfd, clink);		/* Found it, remove link */
 			if (--serv->attr.ref <= 0)
 			    serv->attr.flags &= ~SERV_ENABLED;
 		    }
@@ -4328,8 +6352,8 @@ int main (int argc, char *argv[])
 		 * If we haven't found it and we shouldn't delete it
 		 * we try to add it.
 		 */
-		if (!del && !found) {
-		    xsymlink(dfd, olink, nlink);
+		if (!rem && !found) {
+		    rcsymlink(dfd, olink, nlink, rcs);
 		    if (++serv->attr.ref)
 			serv->attr.flags |= SERV_ENABLED;
 		    found = true;
@@ -4338,6 +6362,7 @@ int main (int argc, char *argv[])
 	}
 
 	popd();
+	rcmap_free(&rcmap);
 	closedir(rcdir);
     }
 # endif /* !SUSE, standard SystemV link scheme */
@@ -4346,16 +6371,45 @@ int main (int argc, char *argv[])
     /*
      * Do the makedep
      */
+    stats_phase("makedep");
     makedep();
 
+    /*
+     * Remember the LSB headers for the next run
+     */
+    stats_phase("save_cache");
+    lsbcache_save();
+
     /*
      * Back to the root(s)
      */
     popd();
 
+    /*
+     * Remember if nothing has been changed
+     */
+    if (snapshot) {
+	stats_phase("save_snapshot");
+	snapshot_save(path, override_path, insconf);
+    }
+out:
+    queue_done(!dryrun);
+    stats_show();
+
     /*
      * Make valgrind happy
      */
+#ifdef WANT_SYSTEMD
+    hash_free(&sdshadows);
+#endif /* WANT_SYSTEMD */
+    arena_free();
+    free(snapshot_log);
+    free(argr);
+    free(argd);
+    if (batch) {
+	free(argv);
+	free(batch_data);
+    }
     if (path != ipath) free(path);
     if (root) free(root);
     if ( (free_dependency_path) && (dependency_path) )
@@ -4372,3 +6426,61 @@ int main (int argc, char *argv[])
     }
     return 0;
 }
+
+/*
+ * The daemon keeps the LSB headers of the former runs resident,
+ * the cache file is read again only if a run has changed it.
+ */
+static void insservd_ready(void)
+{
+    lsbcache_load();
+}
+
+static int insservd(int argc, char *argv[], const char *socket)
+{
+    boolean verbose = false;
+    int c;
+
+    while ((c = getopt(argc, argv, "vh")) != -1) {
+	switch (c) {
+	case 'v':
+	    verbose = true;
+	    break;
+	case 'h':
+	    printf("Usage: %s [-v] [<socket>]\n", myname);
+	    return 0;
+	default:
+	    error("usage: %s [-v] [<socket>]\n", myname);
+	}
+    }
+    if (optind < argc)
+	socket = argv[optind];
+    optind = 0;				/* The requests start getopt(3) again */
+
+    return insservd_serve(socket, insserv, insservd_ready, verbose);
+}
+
+/*
+ * Serve the requests of insserv if called as insservd, otherwise
+ * do the job or, only if asked for with INSSERVD_SOCKET, let a
+ * running daemon do it.
+ */
+int main (int argc, char *argv[])
+{
+    const char * socket = getenv("INSSERVD_SOCKET");
+    int status;
+
+    myname = basename(*argv);
+    if (!strcmp(myname, "insservd"))
+	return insservd(argc, argv, (socket && *socket) ? socket : INSSERVD_SOCKET);
+
+    if (!socket || !*socket)
+	return insserv(argc, argv);
+#ifdef SUSE
+    if (underrpm())
+	return insserv(argc, argv);	/* The daemon can not see rpm */
+#endif /* SUSE */
+    if (insservd_forward(socket, argc, argv, &status))
+	return status;
+    return insserv(argc, argv);
+}
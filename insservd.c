@@ -0,0 +1,412 @@
+/*
+ * insservd.c
+ *
+ * This source is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "listing.h"
+#include "insservd.h"
+
+/*
+ * A request is the command line and the environment of a client
+ * together with its umask, its standard input, output, and error,
+ * its working directory, and its root directory, all passed over an
+ * AF_UNIX socket.  The answer is the exit status of the run or
+ * INSSERVD_REFUSED, then the client does the job itself.
+ */
+#define INSSERVD_MAGIC		0x69737664U
+#define INSSERVD_REFUSED	(-1)
+#define INSSERVD_FDS		5	/* stdin, stdout, stderr, cwd, and root */
+#define INSSERVD_ARGS		(64*1024)
+
+typedef struct request_struct {
+    uint32_t		   magic;
+    uint32_t		    argc;
+    uint32_t		    envc;
+    uint32_t		   umask;
+    uint32_t		    size;	/* Bytes of the arguments and environment following */
+} request_t;
+
+extern char **environ;
+
+typedef union control_union {
+    struct cmsghdr	   align;
+    char		     buf[CMSG_SPACE(INSSERVD_FDS * sizeof(int))];
+} control_t;
+
+static boolean sockaddr(struct sockaddr_un *restrict const addr, const char *restrict const path) attribute((nonnull(1,2)));
+static boolean sockaddr(struct sockaddr_un *restrict const addr, const char *restrict const path)
+{
+    if (strlen(path) >= sizeof(addr->sun_path))
+	return false;
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+static boolean xfer(const int fd, void *restrict buf, size_t len, const boolean out) attribute((nonnull(2)));
+static boolean xfer(const int fd, void *restrict buf, size_t len, const boolean out)
+{
+    char * ptr = (char*)buf;
+
+    while (len) {
+	const ssize_t ret = out ? send(fd, ptr, len, MSG_NOSIGNAL) : recv(fd, ptr, len, 0);
+	if (ret < 0 && errno == EINTR)
+	    continue;
+	if (ret <= 0)
+	    return false;
+	ptr += ret;
+	len -= ret;
+    }
+    return true;
+}
+
+/*
+ * Let the daemon run the command line if it is there and owned by
+ * root or by our user.  If false is returned the request was not
+ * taken and the caller has to do it.
+ */
+boolean insservd_forward(const char *restrict const path, const int argc, char *const argv[],
+			 int *restrict const status)
+{
+    struct sockaddr_un addr;
+    struct cmsghdr * cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    control_t control;
+    request_t req;
+    int fds[INSSERVD_FDS];
+    boolean ret = false;
+    char * args = (char*)0, * ptr;
+    int32_t answer;
+    size_t size = 0;
+    mode_t mask;
+    int sock, n, envc;
+
+    if (!sockaddr(&addr, path))
+	return false;
+    if ((sock = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0)
+	return false;
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	goto out;
+
+    /*
+     * Our descriptors are not handed over to any other user.
+     */
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+	goto out;
+    if (cred.uid != 0 && cred.uid != geteuid()) {
+	warn("insservd at %s runs for uid %ld, not used\n", path, (long)cred.uid);
+	goto out;
+    }
+
+    for (n = 0; n < argc; n++)
+	size += strlen(argv[n]) + 1;
+    for (envc = 0; environ && environ[envc]; envc++)
+	size += strlen(environ[envc]) + 1;
+    if (size > INSSERVD_ARGS)
+	goto out;
+    if (!(args = (char*)malloc(size + 1)))
+	error("%s", strerror(errno));
+    for (n = 0, ptr = args; n < argc; n++)
+	ptr = stpcpy(ptr, argv[n]) + 1;
+    for (n = 0; n < envc; n++)
+	ptr = stpcpy(ptr, environ[n]) + 1;
+
+    fds[0] = STDIN_FILENO;
+    fds[1] = STDOUT_FILENO;
+    fds[2] = STDERR_FILENO;
+    if ((fds[3] = open(".", O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0)
+	goto out;
+    if ((fds[4] = open("/", O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0) {
+	close(fds[3]);
+	goto out;
+    }
+    mask = umask(0);
+    umask(mask);
+
+    req.magic = INSSERVD_MAGIC;
+    req.argc = argc;
+    req.envc = envc;
+    req.umask = mask;
+    req.size = size;
+    iov.iov_base = &req;
+    iov.iov_len = sizeof(req);
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    close(fds[3]);
+    close(fds[4]);
+    if (n != (int)sizeof(req) || !xfer(sock, args, size, true))
+	goto out;
+
+    /*
+     * From now on the request may be done, therefore
+     * it is not repeated if the answer gets lost.
+     */
+    if (!xfer(sock, &answer, sizeof(answer), false)) {
+	warn("lost connection to insservd at %s\n", path);
+	answer = 1;
+    }
+    if (answer != INSSERVD_REFUSED) {
+	*status = answer;
+	ret = true;
+    }
+out:
+    free(args);
+    close(sock);
+    return ret;
+}
+
+/*
+ * Receive a request and its file descriptors, the arguments
+ * are returned within a null terminated list followed by the
+ * null terminated environment returned in envp.
+ */
+static char ** receive(const int conn, int *restrict const argc, char ***restrict const envp,
+		       mode_t *restrict const mask, int *restrict const fds) attribute((nonnull(2,3,4,5)));
+static char ** receive(const int conn, int *restrict const argc, char ***restrict const envp,
+		       mode_t *restrict const mask, int *restrict const fds)
+{
+    struct cmsghdr * cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    control_t control;
+    request_t req;
+    char ** argv = (char**)0, * args, * ptr;
+    ssize_t ret;
+    int n;
+
+    iov.iov_base = &req;
+    iov.iov_len = sizeof(req);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    do
+	ret = recvmsg(conn, &msg, MSG_WAITALL|MSG_CMSG_CLOEXEC);
+    while (ret < 0 && errno == EINTR);
+
+    for (n = 0; n < INSSERVD_FDS; n++)
+	fds[n] = -1;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+	if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+	    continue;
+	if (cmsg->cmsg_len == CMSG_LEN(INSSERVD_FDS * sizeof(int)) && fds[0] < 0) {
+	    memcpy(fds, CMSG_DATA(cmsg), INSSERVD_FDS * sizeof(int));
+	    continue;
+	}
+	for (n = 0; (size_t)CMSG_LEN((n + 1) * sizeof(int)) <= cmsg->cmsg_len; n++)
+	    close(((int*)CMSG_DATA(cmsg))[n]);
+    }
+
+    if (ret != (ssize_t)sizeof(req) || fds[0] < 0 || (msg.msg_flags & MSG_CTRUNC))
+	goto err;
+    if (req.magic != INSSERVD_MAGIC || req.argc == 0 || req.size > INSSERVD_ARGS)
+	goto err;
+    if (req.envc > req.size || req.argc > req.size - req.envc)
+	goto err;
+
+    if (!(argv = (char**)malloc((req.argc + req.envc + 2) * sizeof(char*) + req.size)))
+	error("%s", strerror(errno));
+    args = (char*)&argv[req.argc + req.envc + 2];
+    if (!xfer(conn, args, req.size, false) || args[req.size - 1] != '\0')
+	goto err;
+
+    for (n = 0, ptr = args; n < (int)(req.argc + 1 + req.envc); n++) {
+	if (n == (int)req.argc) {
+	    argv[n] = (char*)0;
+	    continue;
+	}
+	if (ptr >= args + req.size)
+	    goto err;
+	argv[n] = ptr;
+	ptr += strlen(ptr) + 1;
+    }
+    if (ptr != args + req.size)
+	goto err;
+    argv[n] = (char*)0;
+    *argc = req.argc;
+    *envp = &argv[req.argc + 1];
+    *mask = req.umask & 0777;
+    return argv;
+err:
+    free(argv);
+    for (n = 0; n < INSSERVD_FDS; n++) {
+	if (fds[n] >= 0)
+	    close(fds[n]);
+	fds[n] = -1;
+    }
+    return (char**)0;
+}
+
+static const char * sockpath;
+
+static void terminate(int sig)
+{
+    unlink(sockpath);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/*
+ * Check if the root directory of the client is our own, otherwise
+ * the client e.g. runs within a chroot environment sharing /run.
+ */
+static boolean sameroot(const int fd)
+{
+    struct stat st, root;
+
+    if (fstat(fd, &st) < 0 || stat("/", &root) < 0)
+	return false;
+    return (st.st_dev == root.st_dev && st.st_ino == root.st_ino);
+}
+
+/*
+ * Serve the requests of the clients one by one, each within a child
+ * process forked after ready().  This is only a fork server: a child
+ * does a full run and ends, no dependency graph is kept resident, there
+ * is nothing to invalidate, and there is no query interface.  Only
+ * clients with the same user and the same root directory as the daemon
+ * are served.
+ */
+int insservd_serve(const char *restrict const path, int (*run)(int, char *[]),
+		   void (*ready)(void), const boolean verbose)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int sock, conn;
+
+    if (!sockaddr(&addr, path))
+	error("socket path %s too long\n", path);
+    if ((sock = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0)
+	error("can not create socket: %s\n", strerror(errno));
+
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+	if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+	    error("%s is already served\n", path);
+	unlink(path);				/* Left over by a former daemon */
+    }
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || chmod(path, 0600) < 0 || listen(sock, 16) < 0)
+	error("can not listen on %s: %s\n", path, strerror(errno));
+
+    sockpath = path;
+    signal(SIGTERM, terminate);
+    signal(SIGINT, terminate);
+    signal(SIGHUP, terminate);
+    signal(SIGPIPE, SIG_IGN);
+    ready();
+
+    for (;;) {
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	int fds[INSSERVD_FDS], argc = 0, n;
+	int32_t answer = INSSERVD_REFUSED;
+	char ** argv = (char**)0, ** envp;
+	mode_t mask;
+	pid_t pid;
+
+	if ((conn = accept4(sock, (struct sockaddr*)0, (socklen_t*)0, SOCK_CLOEXEC)) < 0) {
+	    if (errno == EINTR || errno == ECONNABORTED)
+		continue;
+	    error("can not accept on %s: %s\n", path, strerror(errno));
+	}
+
+	if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 || cred.uid != geteuid())
+	    goto answer;
+	if (!(argv = receive(conn, &argc, &envp, &mask, fds)))
+	    goto answer;
+	if (!sameroot(fds[4])) {
+	    if (verbose)
+		fprintf(stderr, "insservd: refused pid %ld with other root\n", (long)cred.pid);
+	    goto close;
+	}
+	if (verbose) {
+	    fputs("insservd: run", stderr);
+	    for (n = 0; n < argc; n++)
+		fprintf(stderr, " %s", argv[n]);
+	    fprintf(stderr, " for pid %ld\n", (long)cred.pid);
+	}
+
+	ready();
+	fflush(stdout);
+	fflush(stderr);
+	if ((pid = fork()) < 0)
+	    goto close;
+	if (pid == 0) {
+	    close(sock);
+	    close(conn);
+	    signal(SIGTERM, SIG_DFL);
+	    signal(SIGINT, SIG_DFL);
+	    signal(SIGHUP, SIG_DFL);
+	    signal(SIGPIPE, SIG_DFL);
+	    for (n = 0; n < 3; n++)
+		dup2(fds[n], n);
+	    if (fchdir(fds[3]) < 0)
+		error("can not change working directory: %s\n", strerror(errno));
+	    for (n = 0; n < INSSERVD_FDS; n++)
+		close(fds[n]);
+	    umask(mask);
+	    environ = envp;
+	    exit(run(argc, argv));
+	}
+	answer = 1;
+	while (waitpid(pid, &n, 0) < 0) {
+	    if (errno != EINTR)
+		goto close;
+	}
+	if (WIFEXITED(n))
+	    answer = WEXITSTATUS(n);
+	else if (WIFSIGNALED(n))
+	    answer = 128 + WTERMSIG(n);
+    close:
+	for (n = 0; n < INSSERVD_FDS; n++)
+	    close(fds[n]);
+    answer:
+	xfer(conn, &answer, sizeof(answer), true);
+	close(conn);
+	free(argv);
+    }
+    return 0;
+}
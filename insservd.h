@@ -0,0 +1,30 @@
+/*
+ * insservd.h
+ *
+ * This source is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+/*
+ * The daemon is a fork server which runs the requests of the insserv
+ * clients, see insservd.c.  The clients use it only if INSSERVD_SOCKET
+ * is set in their environment.
+ */
+#define INSSERVD_SOCKET	"/run/insservd.socket"
+
+extern boolean insservd_forward(const char *restrict const path, const int argc, char *const argv[],
+				int *restrict const status) attribute((nonnull(1,3,4)));
+extern int insservd_serve(const char *restrict const path, int (*run)(int, char *[]),
+			  void (*ready)(void), const boolean verbose) attribute((nonnull(1,2,3)));
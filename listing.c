@@ -27,18 +27,24 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <ctype.h>
 #include "listing.h"
 
 int maxstart = 0;  		/* Maximum start order of runlevels 0 upto 6 and S */
 int maxstop  = 0;  		/* Maximum stop  order of runlevels 0 upto 6 and S */
+boolean linear_order = false;	/* Use the linear time ordering instead of __follow() */
 static int *maxorder;		/* Pointer to one of above */
+static boolean order_warned;	/* The ordering has warned about something */
 
 /* See listing.c for list_t and list_entry() macro */
 #define getdir(list)		list_entry((list), dir_t,   d_list)
 #define getlink(list)		list_entry((list), link_t,  l_list)
-#define getnextlink(list)	(list_empty(list) ? (dir_t*)0 : getlink((list)->next)->target)
 
 /*
  * We handle services (aka scripts) as directories because
@@ -52,6 +58,7 @@ typedef struct dir_struct dir_t;
 typedef struct link_struct {
     list_t		  l_list;	/* The linked list of symbolic links */
     dir_t	*restrict target;
+    ushort		  origin;	/* The REQ_ bits of the requests for this link */
 } __align link_t;			/* This is a "symbolic link" */
 
 typedef struct handle_struct {
@@ -60,7 +67,7 @@ typedef struct handle_struct {
     ushort		   flags;
     uchar		 mindeep;	/* Default start/stop deep if any */
     uchar		    deep;	/* Current start/stop deep */
-    char		  * name;
+    const char		  * name;
 } __align handle_t;
 
 struct dir_struct {
@@ -69,8 +76,9 @@ struct dir_struct {
     handle_t		   stopp;
     service_t	  *restrict serv;
     int			     ref;
-    char		* script;
-    char		  * name;
+    uint		   index;	/* Position in the directory list for linear ordering */
+    const char		* script;
+    const char		  * name;
 } __align;				/* This is a "directory" */
 
 #define attof(dir)	(&(dir)->serv->attr)
@@ -96,35 +104,504 @@ static list_t servs = { &servs, &servs };
 list_t * s_start = &servs;
 
 /*
- * Provide or find a service dir, set initial states and
- * link it into the maintaining if a new one.
+ * Index of all services by their names and of all service
+ * dirs by their script names.  Several dirs may share one
+ * script, in that case the script index only marks the entry
+ * as shared and the lookup falls back to the list of dirs.
  */
+static hash_t servidx;
+static hash_t scrpidx;
+#define SCRIPT_SHARED	((void*)&scrpidx)
 
-static inline dir_t * providedir(const char *restrict const name) attribute((malloc,always_inline,nonnull(1)));
-static inline dir_t * providedir(const char *restrict const name)
+/*
+ * The table of atoms, each distinct name of a service, script or
+ * facility is stored only once within the arena.  Two interned names
+ * are equal if and only if the pointers are equal.
+ */
+static hash_t atoms;
+
+/*
+ * The hash function (FNV-1a) used for all string keys
+ */
+static inline uint hashstr(const char *restrict key) attribute((always_inline,pure,nonnull(1)));
+static inline uint hashstr(const char *restrict key)
 {
-    dir_t *restrict dir = (dir_t*)0;
-    service_t *restrict serv;
-    list_t * ptr;
+    register uint hash = 2166136261U;
+    while (*key) {
+	hash ^= (uchar)*key++;
+	hash *= 16777619U;
+    }
+    return hash;
+}
 
-    list_for_each_prev(ptr, d_start) {
-	dir = getdir(ptr);
-	if (!strcmp(dir->name, name))
+static void hash_grow(hash_t *restrict const tab) attribute((nonnull(1)));
+static void hash_grow(hash_t *restrict const tab)
+{
+    struct hash_entry * old = tab->slot;
+    const uint size = tab->size;
+    uint n;
+
+    tab->size = size ? (size << 1) : 64;
+    if (!(tab->slot = (struct hash_entry*)calloc(tab->size, sizeof(struct hash_entry))))
+	error("%s", strerror(errno));
+
+    for (n = 0; n < size; n++) {
+	uint pos;
+	if (!old[n].key)
+	    continue;
+	pos = hashstr(old[n].key) & (tab->size - 1);
+	while (tab->slot[pos].key)
+	    pos = (pos + 1) & (tab->size - 1);
+	tab->slot[pos] = old[n];
+    }
+    free(old);
+}
+
+/*
+ * Find the value of a key within a hash table
+ */
+void * hash_get(const hash_t *restrict const tab, const char *restrict const key)
+{
+    void * ret = (void*)0;
+    uint pos;
+
+    if (!tab->size)
+	goto out;
+
+    pos = hashstr(key) & (tab->size - 1);
+    while (tab->slot[pos].key) {
+	if (!strcmp(tab->slot[pos].key, key)) {
+	    ret = tab->slot[pos].val;
+	    break;
+	}
+	pos = (pos + 1) & (tab->size - 1);
+    }
+out:
+    return ret;
+}
+
+/*
+ * Find or add the slot of a key within a hash table and return
+ * the address of its value, which is a null pointer if new.
+ */
+void ** hash_put(hash_t *restrict const tab, const char *restrict const key)
+{
+    uint pos;
+
+    if ((tab->count + 1) * 4 > tab->size * 3)
+	hash_grow(tab);
+
+    pos = hashstr(key) & (tab->size - 1);
+    while (tab->slot[pos].key) {
+	if (!strcmp(tab->slot[pos].key, key))
 	    goto out;
+	pos = (pos + 1) & (tab->size - 1);
     }
+    tab->slot[pos].key = key;
+    tab->count++;
+out:
+    return &tab->slot[pos].val;
+}
 
-    if (posix_memalign((void*)&serv, sizeof(void*), alignof(service_t)+strsize(name)) != 0)
+void hash_free(hash_t *restrict const tab)
+{
+    free(tab->slot);
+    tab->slot = (struct hash_entry*)0;
+    tab->size = tab->count = 0;
+}
+
+/*
+ * Set of all edges of the dependency graph, that is the links of the
+ * start and stop lists of the dirs and the requests of the sort lists
+ * of the services.  An edge is found by the address of the list head
+ * and its target, this makes the check for duplicates O(1).
+ */
+typedef struct edge_struct {
+    const void		   * list;
+    const void		    * key;
+    void		   * node;	/* The link_t or req_t within the list */
+} edge_t;
+
+static struct edge_table {
+    uint		    size;	/* Number of slots, always a power of two */
+    uint		   count;
+    edge_t		  * slot;
+} edges;
+
+static inline uint hashedge(const void *restrict const list, const void *restrict const key) attribute((always_inline,const));
+static inline uint hashedge(const void *restrict const list, const void *restrict const key)
+{
+    unsigned long long hash = (unsigned long long)(uintptr_t)list * 0x9E3779B97F4A7C15ULL;
+    hash ^= (unsigned long long)(uintptr_t)key * 0xC2B2AE3D27D4EB4FULL;
+    return (uint)(hash >> 32);
+}
+
+static void edge_grow(void)
+{
+    edge_t * old = edges.slot;
+    const uint size = edges.size;
+    uint n;
+
+    edges.size = size ? (size << 1) : 256;
+    if (!(edges.slot = (edge_t*)calloc(edges.size, sizeof(edge_t))))
 	error("%s", strerror(errno));
 
-    memset(serv, 0, alignof(service_t)+strsize(name));
-    insert(&serv->s_list, s_start->prev);
-    serv->name = ((char*)serv)+alignof(service_t);
+    for (n = 0; n < size; n++) {
+	uint pos;
+	if (!old[n].list)
+	    continue;
+	pos = hashedge(old[n].list, old[n].key) & (edges.size - 1);
+	while (edges.slot[pos].list)
+	    pos = (pos + 1) & (edges.size - 1);
+	edges.slot[pos] = old[n];
+    }
+    free(old);
+}
+
+void * edge_get(const void *restrict const list, const void *restrict const key)
+{
+    void * ret = (void*)0;
+    uint pos;
+
+    if (!edges.size)
+	goto out;
+
+    pos = hashedge(list, key) & (edges.size - 1);
+    while (edges.slot[pos].list) {
+	if (edges.slot[pos].list == list && edges.slot[pos].key == key) {
+	    ret = edges.slot[pos].node;
+	    break;
+	}
+	pos = (pos + 1) & (edges.size - 1);
+    }
+out:
+    return ret;
+}
+
+void edge_put(const void *restrict const list, const void *restrict const key, void *restrict const node)
+{
+    uint pos;
+
+    if ((edges.count + 1) * 4 > edges.size * 3)
+	edge_grow();
 
-    if (posix_memalign((void*)&dir, sizeof(void*), alignof(dir_t)) != 0)
+    pos = hashedge(list, key) & (edges.size - 1);
+    while (edges.slot[pos].list) {
+	if (edges.slot[pos].list == list && edges.slot[pos].key == key)
+	    goto out;
+	pos = (pos + 1) & (edges.size - 1);
+    }
+    edges.slot[pos].list = list;
+    edges.slot[pos].key  = key;
+    edges.count++;
+out:
+    edges.slot[pos].node = node;
+}
+
+/*
+ * Forget an edge, but only if it still refers to the given node.
+ * The following entries of the probe sequence are moved back to
+ * keep them reachable.
+ */
+void edge_del(const void *restrict const list, const void *restrict const key, const void *restrict const node)
+{
+    uint pos, next;
+
+    if (!edges.size)
+	return;
+
+    pos = hashedge(list, key) & (edges.size - 1);
+    while (edges.slot[pos].list) {
+	if (edges.slot[pos].list == list && edges.slot[pos].key == key)
+	    break;
+	pos = (pos + 1) & (edges.size - 1);
+    }
+    if (!edges.slot[pos].list || edges.slot[pos].node != node)
+	return;
+
+    next = pos;
+    for (;;) {
+	uint home;
+	next = (next + 1) & (edges.size - 1);
+	if (!edges.slot[next].list)
+	    break;
+	home = hashedge(edges.slot[next].list, edges.slot[next].key) & (edges.size - 1);
+	if (((next - home) & (edges.size - 1)) < ((next - pos) & (edges.size - 1)))
+	    continue;			/* Entry is at or behind its home slot */
+	edges.slot[pos] = edges.slot[next];
+	pos = next;
+    }
+    memset(&edges.slot[pos], 0, sizeof(edge_t));
+    edges.count--;
+}
+
+/*
+ * Once all links are known the graph is frozen into arrays in
+ * compressed sparse row form: the links of the dir with the index n
+ * are edge[first[n]] upto edge[first[n+1]-1], the reverse arrays hold
+ * the same links seen from their targets.  The orderings walk these
+ * arrays instead of chasing the linked lists.  Any change of the links
+ * or of the list of dirs thaws the graph, it is frozen again on its
+ * next use.  Dirs reached by links but not within the list of dirs
+ * get an index behind all dirs of the list.
+ */
+typedef struct adjacency_struct {
+    uint		 * first;	/* Offsets into edge, one more than nodes */
+    uint		  * edge;	/* Indices of the targets */
+    ushort		* origin;	/* The REQ_ bits of the links */
+} adjacency_t;
+
+static struct graph_struct {
+    boolean		   valid;
+    uint		   count;	/* Number of dirs within the list of dirs */
+    uint		   total;	/* Number of all dirs reached */
+    dir_t	       ** node;
+    adjacency_t	    start, stopp;
+    adjacency_t	  rstart, rstopp;	/* The reverse links */
+} graph;
+
+#define getnextedge(adj, n)	\
+	(((adj)->first[(n)] == (adj)->first[(n)+1]) ? (dir_t*)0 : graph.node[(adj)->edge[(adj)->first[(n)]]])
+#define getadj(mode)	(((mode) == 'K') ? &graph.stopp : &graph.start)
+#define getradj(mode)	(((mode) == 'K') ? &graph.rstopp : &graph.rstart)
+#define for_each_edge(e, adj, n)	\
+	for (e = (adj)->first[(n)]; e < (adj)->first[(n)+1]; e++)
+
+static inline handle_t * gethandle(dir_t *restrict const dir, const char mode) attribute((always_inline,nonnull(1)));
+static inline handle_t * gethandle(dir_t *restrict const dir, const char mode)
+{
+    return (mode == 'K') ? &dir->stopp : &dir->start;
+}
+
+static void adjacency(adjacency_t *restrict const adj, adjacency_t *restrict const rev,
+		      const uint links, const char mode) attribute((nonnull(1,2)));
+static void adjacency(adjacency_t *restrict const adj, adjacency_t *restrict const rev,
+		      const uint links, const char mode)
+{
+    const uint total = graph.total;
+    uint n, e;
+
+    if (posix_memalign((void*)&adj->first,  sizeof(void*), (total + 1) * sizeof(uint)) != 0 ||
+	posix_memalign((void*)&adj->edge,   sizeof(void*), (links + 1) * sizeof(uint)) != 0 ||
+	posix_memalign((void*)&adj->origin, sizeof(void*), (links + 1) * sizeof(ushort)) != 0 ||
+	posix_memalign((void*)&rev->first,  sizeof(void*), (total + 1) * sizeof(uint)) != 0 ||
+	posix_memalign((void*)&rev->edge,   sizeof(void*), (links + 1) * sizeof(uint)) != 0)
+	error("%s", strerror(errno));
+    rev->origin = (ushort*)0;
+    memset(rev->first, 0, (total + 1) * sizeof(uint));
+
+    for (n = e = 0; n < total; n++) {
+	list_t * dent;
+	adj->first[n] = e;
+	list_for_each(dent, &gethandle(graph.node[n], mode)->link) {
+	    const link_t * link = getlink(dent);
+	    adj->edge[e] = link->target->index;
+	    adj->origin[e++] = link->origin;
+	    rev->first[link->target->index]++;
+	}
+    }
+    adj->first[total] = e;
+
+    /*
+     * Counting sort of the links by their targets, filled from
+     * the end to keep the sources of each target in ascending order.
+     */
+    for (n = 1; n <= total; n++)
+	rev->first[n] += rev->first[n-1];
+    for (n = total; n-- > 0;) {
+	for (e = adj->first[n+1]; e-- > adj->first[n];)
+	    rev->edge[--rev->first[adj->edge[e]]] = n;
+    }
+}
+
+static void thaw(void)
+{
+    adjacency_t * adj[] = { &graph.start, &graph.stopp, &graph.rstart, &graph.rstopp };
+    uint n;
+
+    if (!graph.valid)
+	return;
+    for (n = 0; n < sizeof(adj)/sizeof(adj[0]); n++) {
+	free(adj[n]->first);
+	free(adj[n]->edge);
+	free(adj[n]->origin);
+    }
+    free(graph.node);
+    memset(&graph, 0, sizeof(graph));
+}
+
+void freeze(void)
+{
+    list_t * tmp;
+    uint size = 0, links[2] = { 0, 0 }, n;
+
+    if (graph.valid)
+	return;
+
+    list_for_each(tmp, d_start)
+	size++;
+    if (posix_memalign((void*)&graph.node, sizeof(void*), (size + 1) * sizeof(dir_t*)) != 0)
+	error("%s", strerror(errno));
+    list_for_each(tmp, d_start) {
+	dir_t * dir = getdir(tmp);
+	dir->index = graph.count;
+	graph.node[graph.count++] = dir;
+    }
+    graph.total = graph.count;
+
+    for (n = 0; n < graph.total; n++) {
+	handle_t * peg[2] = { &graph.node[n]->start, &graph.node[n]->stopp };
+	uint h;
+	for (h = 0; h < 2; h++) {
+	    list_t * dent;
+	    list_for_each(dent, &peg[h]->link) {
+		dir_t * target = getlink(dent)->target;
+		links[h]++;
+		if (target->index < graph.total && graph.node[target->index] == target)
+		    continue;
+		if (graph.total == size) {
+		    size *= 2;
+		    if (!(graph.node = (dir_t**)realloc(graph.node, (size + 1) * sizeof(dir_t*))))
+			error("%s", strerror(errno));
+		}
+		target->index = graph.total;
+		graph.node[graph.total++] = target;
+	    }
+	}
+    }
+
+    adjacency(&graph.start, &graph.rstart, links[0], 'S');
+    adjacency(&graph.stopp, &graph.rstopp, links[1], 'K');
+    graph.valid = true;
+}
+
+/*
+ * The arena is a list of large chunks, the memory of the current
+ * chunk is handed out by bumping a pointer.  Large requests get a
+ * chunk of their own and leave the current one as it is.
+ */
+#define CHUNK_SIZE	(64*1024)
+typedef struct chunk_struct {
+    struct chunk_struct	   * next;
+} __align chunk_t;
+
+static chunk_t * chunks;
+static char * arena_next, * arena_end;
+static pool_t pool_last;			/* End of the list of pools in use */
+static pool_t * pools = &pool_last;
+
+void * arena_alloc(size_t size)
+{
+    chunk_t * chunk;
+    void * ret;
+
+    size = (size + (sizeof(void*)-1)) & ~(sizeof(void*)-1);
+    if (size <= (size_t)(arena_end - arena_next)) {
+	ret = arena_next;
+	arena_next += size;
+	goto out;
+    }
+
+    if (posix_memalign((void*)&chunk, sizeof(void*), alignof(chunk_t) + (size > CHUNK_SIZE/4 ? size : CHUNK_SIZE)) != 0)
 	error("%s", strerror(errno));
+    chunk->next = chunks;
+    chunks = chunk;
+    ret = ((char*)chunk)+alignof(chunk_t);
+
+    if (size > CHUNK_SIZE/4)
+	goto out;
+
+    arena_next = (char*)ret + size;
+    arena_end  = (char*)ret + CHUNK_SIZE;
+out:
+    return ret;
+}
+
+/*
+ * Slow path of pool_get(), remember the pool to be able to
+ * forget its nodes if the arena is released.
+ */
+void * pool_grow(pool_t *restrict const pool)
+{
+    if (!pool->next) {
+	pool->next = pools;
+	pools = pool;
+    }
+    return arena_alloc(pool->size);
+}
+
+void arena_free(void)
+{
+    while (chunks) {
+	chunk_t * chunk = chunks;
+	chunks = chunk->next;
+	free(chunk);
+    }
+    arena_next = arena_end = (char*)0;
+
+    while (pools != &pool_last) {
+	pool_t * pool = pools;
+	pools = pool->next;
+	pool->next = (pool_t*)0;
+	pool->free = (void*)0;
+    }
+
+    free(edges.slot);
+    memset(&edges, 0, sizeof(edges));
+    thaw();
+
+    /*
+     * Nothing may point into the released chunks
+     */
+    hash_free(&atoms);
+    hash_free(&servidx);
+    hash_free(&scrpidx);
+    initial(&dirs);
+    initial(&servs);
+}
+#undef CHUNK_SIZE
+
+/*
+ * The pools of the nodes of the dependency graph
+ */
+static pool_t pool_dir  = POOL(dir_t);
+static pool_t pool_link = POOL(link_t);
+pool_t pool_req = POOL(req_t);
+
+const char * intern(const char *restrict const name)
+{
+    char * atom = (char*)hash_get(&atoms, name);
+
+    if (atom)
+	goto out;
+
+    atom = (char*)arena_alloc(strsize(name));
+    strcpy(atom, name);
+    *hash_put(&atoms, atom) = (void*)atom;
+out:
+    return atom;
+}
+
+/*
+ * Provide a new service dir, set initial states and
+ * link it into the maintaining lists and the index.
+ * Existing services are found by addservice() below.
+ */
+
+static inline dir_t * providedir(const char *restrict const name) attribute((malloc,always_inline,nonnull(1)));
+static inline dir_t * providedir(const char *restrict const name)
+{
+    dir_t *restrict dir = (dir_t*)0;
+    service_t *restrict serv;
+
+    serv = (service_t*)arena_alloc(alignof(service_t));
+    memset(serv, 0, alignof(service_t));
+    insert(&serv->s_list, s_start->prev);
+    serv->name = intern(name);
 
-    memset(dir, 0, alignof(dir_t));
+    dir = (dir_t*)pool_get(&pool_dir);
     insert(&dir->d_list, d_start->prev);
+    thaw();
     dir->ref = 1;
 
     serv->dir = (void*)dir;
@@ -136,7 +613,6 @@ static inline dir_t * providedir(const char *restrict const name)
     initial(&serv->sort.req);
     initial(&serv->sort.rev);
 
-    strcpy(serv->name, name);
     dir->name	    = serv->name;
     dir->start.name = serv->name;
     dir->stopp.name = serv->name;
@@ -146,7 +622,9 @@ static inline dir_t * providedir(const char *restrict const name)
 
     serv->start = &dir->start.run;
     serv->stopp = &dir->stopp.run;
-out:
+
+    *hash_put(&servidx, serv->name) = (void*)serv;
+
     return dir;
 }
 
@@ -156,18 +634,12 @@ out:
 service_t * addservice(const char *restrict const serv) attribute((malloc,nonnull(1)));
 service_t * addservice(const char *restrict const serv)
 {
-    service_t * this;
-    list_t * ptr;
-    dir_t * dir;
+    service_t * this = (service_t*)hash_get(&servidx, serv);
 
-    list_for_each_prev(ptr, s_start) {
-	this = getservice(ptr);
-	if (!strcmp(this->name, serv))
-	    goto out;
+    if (!this) {
+	dir_t * dir = providedir(serv);
+	this = dir->serv;
     }
-    dir = providedir(serv);
-    this = dir->serv;
-out:
     return this;
 }
 
@@ -186,9 +658,13 @@ service_t * getorig(service_t *restrict const serv)
 static inline dir_t * findscript(const char *restrict const script) attribute((always_inline,nonnull(1)));
 static inline dir_t * findscript(const char *restrict const script)
 {
-    dir_t  * ret = (dir_t*)0;
+    dir_t  * ret = (dir_t*)hash_get(&scrpidx, script);
     list_t * ptr;
 
+    if (ret != SCRIPT_SHARED)
+	goto out;
+
+    ret = (dir_t*)0;
     list_for_each_prev(ptr, d_start) {
 	dir_t * dir = getdir(ptr);
 
@@ -200,7 +676,7 @@ static inline dir_t * findscript(const char *restrict const script)
 	    break;
 	}
     }
-
+out:
     return ret;
 }
 
@@ -208,28 +684,29 @@ static inline dir_t * findscript(const char *restrict const script)
  * Link the current service into the required service.
  * If the services do not exist, they will be created.
  */
-static void ln_sf(dir_t *restrict cur, dir_t *restrict req, const char mode) attribute((nonnull(1,2)));
-static void ln_sf(dir_t *restrict cur, dir_t *restrict req, const char mode)
+static void ln_sf(dir_t *restrict cur, dir_t *restrict req, const char mode, const ushort origin) attribute((nonnull(1,2)));
+static void ln_sf(dir_t *restrict cur, dir_t *restrict req, const char mode, const ushort origin)
 {
-    list_t * dent, * l_list = (mode == 'K') ? &req->stopp.link : &req->start.link;
+    list_t * l_list = (mode == 'K') ? &req->stopp.link : &req->start.link;
     link_t *restrict this;
 
     if (cur == req)
 	goto out;
 
-    list_for_each_prev(dent, l_list) {
-	dir_t * target = getlink(dent)->target;
-	if (!strcmp(target->name, cur->name))
-	    goto out;
-    }
-
-    if (posix_memalign((void*)&this, sizeof(void*), alignof(link_t)) == 0) {
-	insert(&this->l_list, l_list->prev);
-	this->target = cur;
-	++cur->ref;
+    if ((this = (link_t*)edge_get(l_list, cur))) {
+	if ((this->origin & origin) != origin)
+	    thaw();
+	this->origin |= origin;
 	goto out;
     }
-    error("%s", strerror(errno));
+
+    thaw();
+    this = (link_t*)pool_get(&pool_link);
+    insert(&this->l_list, l_list->prev);
+    edge_put(l_list, cur, this);
+    this->target = cur;
+    this->origin = origin;
+    ++cur->ref;
 out:
     return;
 }
@@ -262,18 +739,20 @@ out:
  * order.  In other word, an empty link list of a service
  * indicates that this service has a higher order number.
  */
+static boolean loops_reported;	/* All loops are already told by detect_loops() */
+
 #if defined(DEBUG) && (DEBUG > 0)
 # define loop_warn_two(a,b,o)	\
-	warn("There is a loop between service %s and %s if %s (list:%d)\n", \
-	(a)->name, (b)->name, o, __LINE__)
+	do { if (!loops_reported) warn("There is a loop between service %s and %s if %s (list:%d)\n", \
+	(a)->name, (b)->name, o, __LINE__); } while (0)
 # define loop_warn_one(a,o)	\
-	warn("There is a loop at service %s if %s (list:%d)\n", \
-	(a)->name, o, __LINE__)
+	do { if (!loops_reported) warn("There is a loop at service %s if %s (list:%d)\n", \
+	(a)->name, o, __LINE__); } while (0)
 #else
 # define loop_warn_two(a,b,o)	\
-	warn("There is a loop between service %s and %s if %s\n", (a)->name, (b)->name, o)
+	do { if (!loops_reported) warn("There is a loop between service %s and %s if %s\n", (a)->name, (b)->name, o); } while (0)
 # define loop_warn_one(a,o)	\
-	warn("There is a loop at service %s if %s\n", (a)->name, o)
+	do { if (!loops_reported) warn("There is a loop at service %s if %s\n", (a)->name, o); } while (0)
 #endif
 #define loop_check(a)	\
 	((a) && (a)->flags & DIR_LOOP)
@@ -286,7 +765,8 @@ static void __follow (dir_t *restrict dir, dir_t *restrict skip, const int, cons
 #endif
 static void __follow (dir_t *restrict dir, dir_t *restrict skip, const int level, const char mode, const char reportloop)
 {
-    list_t * l_list;
+    const adjacency_t * adj = getadj(mode);
+    uint cur = dir->index;	/* The dir whose links are followed */
     dir_t * tmp;
     register int deep = level;	/* Link depth, maybe we're called recursively */
     register int loop = 0;	/* Count number of links in symbolic list */
@@ -302,9 +782,6 @@ static void __follow (dir_t *restrict dir, dir_t *restrict skip, const int level
 	if (skip) pskp = &skip->start;
 	act  = "started";
     }
-    l_list = &peg->link;
-    prefetch(l_list->next);
-
     if (peg->flags & DIR_SCAN) {
 	if (pskp) {
 	    if (!remembernode(pskp) || !remembernode(peg))
@@ -327,12 +804,12 @@ static void __follow (dir_t *restrict dir, dir_t *restrict skip, const int level
 	goto out;
     }
 
-    for (tmp = dir; tmp; tmp = getnextlink(l_list)) {
+    for (tmp = dir; tmp; tmp = getnextedge(adj, cur)) {
 	const typeof(attof(tmp)->flags) sflags = attof(tmp)->flags;
 	register boolean recursion = true;
 	handle_t * ptmp = (mode == 'K') ? &tmp->stopp : &tmp->start;
 	uchar  * order = &ptmp->deep;
-	list_t * dent;
+	uint e;
 
 	if (loop++ > MAX_DEEP) {
 	    if (pskp) {
@@ -344,8 +821,7 @@ static void __follow (dir_t *restrict dir, dir_t *restrict skip, const int level
 	    }
 	    break;			/* Loop detected, stop recursion */
 	}
-	l_list = &ptmp->link;		/* List of symbolic links for getnextlink() */
-	prefetch(l_list->next);
+	cur = tmp->index;		/* Links of this dir for getnextedge() */
 
 	if (!((peg->run.lvl) & (ptmp->run.lvl)))
 	     continue;			/* Not same boot level */
@@ -369,7 +845,7 @@ static void __follow (dir_t *restrict dir, dir_t *restrict skip, const int level
 		*maxorder = *order;
 	}
 
-	if (list_empty(l_list))
+	if (adj->first[cur] == adj->first[cur+1])
 	    break;			/* No further service requires this one */
 
 	/*
@@ -391,8 +867,8 @@ static void __follow (dir_t *restrict dir, dir_t *restrict skip, const int level
 	/*
 	 * If there are links in the links included, follow them
 	 */
-	np_list_for_each(dent, l_list) {
-	    dir_t * target = getlink(dent)->target;
+	for_each_edge(e, adj, cur) {
+	    dir_t * target = graph.node[adj->edge[e]];
 	    handle_t * ptrg = (mode == 'K') ? &target->stopp : &target->start;
 	    const typeof(attof(target)->flags) kflags = attof(target)->flags;
 
@@ -430,7 +906,6 @@ static void __follow (dir_t *restrict dir, dir_t *restrict skip, const int level
 		continue;
 						/* The inner recursion */
 	    __follow(target, tmp, deep, mode, reportloop);
-	    prefetch(dent->next);
 
 	    /* Just for the case an inner recursion was stopped */
 	    if (loop_check(ptrg) || loop_check(ptmp) || loop_check(pskp)) {
@@ -440,11 +915,11 @@ static void __follow (dir_t *restrict dir, dir_t *restrict skip, const int level
 	}
 
 	ptmp->flags &= ~DIR_SCAN; 	/* Remove loop detection mark */
-	prefetch(l_list->next);
 
 	if (!recursion) {
 	    if (reportloop && !(ptmp->flags & DIR_LOOPREPORT)) {
-		warn(" loop involving service %s at depth %d\n", tmp->name, level);
+		if (!loops_reported)
+		    warn(" loop involving service %s at depth %d\n", tmp->name, level);
 		ptmp->flags |= DIR_LOOPREPORT;
 	    }
 	    break;			/* Loop detected, stop recursion */
@@ -478,7 +953,8 @@ static void guess_order(dir_t *restrict dir, const char mode) attribute((nonnull
 static void guess_order(dir_t *restrict dir, const char mode)
 {
     handle_t * peg  = (mode == 'K') ? &dir->stopp : &dir->start;
-    list_t * l_list = &peg->link;
+    const adjacency_t * adj = getadj(mode);
+    const uint cur = dir->index;
     register int min = 99;
     register int deep = 0;
     ushort lvl = 0;
@@ -492,170 +968,577 @@ static void guess_order(dir_t *restrict dir, const char mode)
     }
 
     /* No full loop required because we seek for the lowest order */
-    if (!list_empty(l_list)) {
-	dir_t * target = getnextlink(l_list);
+    if (adj->first[cur] != adj->first[cur+1]) {
+	dir_t * target = getnextedge(adj, cur);
 	handle_t * ptrg = (mode == 'K') ? &target->stopp : &target->start;
 	uchar * order = &ptrg->deep;
-	list_t * dent;
+	uint e;
 
 	if ( (order) && (min > *order) )    /* add check to avoid null pointer */
 	    min = *order;
 
 	lvl |= ptrg->run.lvl;
 
-	list_for_each_prev(dent, l_list) {
-	    dir_t * tmp = getlink(dent)->target;
+	for (e = adj->first[cur+1]; e-- > adj->first[cur];) {
+	    dir_t * tmp = graph.node[adj->edge[e]];
 	    handle_t * ptmp = (mode == 'K') ? &tmp->stopp : &tmp->start;
 	    uchar * order = &ptmp->deep;
 
 	    if (++deep > MAX_DEEP)
 		break;
 
-	    if (target == dir)
-		break;		/* Loop detected */
+	    if (target == dir)
+		break;		/* Loop detected */
+
+	    if (min > *order)
+		min = *order;
+
+	    lvl |= ptmp->run.lvl;
+	}
+	if (min > 1) {		/* Set guessed order of this unknown script */
+	    uchar * order = &peg->deep;
+	    *order = min - 1;
+	    peg->run.lvl |= lvl;	/* Set guessed runlevels of this unknown script */
+	} else {
+	    peg->run.lvl  = LVL_BOOT;
+	}
+    }
+out:
+    return;
+}
+
+/*
+ * The linear time ordering: the start or stop order of all services
+ * is the longest path within the graph of the links, calculated in
+ * topological order of Kahn's algorithm.  Each service and each link
+ * is visited exactly once, whereas __follow() may walk shared parts
+ * of the graph again and again.  Links are used only if both services
+ * share a runlevel, the system facilities do not count for the order.
+ */
+static boolean uselink(dir_t *restrict const dir, dir_t *restrict const target,
+		       const char mode, const boolean report) attribute((nonnull(1,2)));
+static boolean uselink(dir_t *restrict const dir, dir_t *restrict const target,
+		       const char mode, const boolean report)
+{
+    const handle_t * peg  = gethandle(dir, mode);
+    const handle_t * ptrg = gethandle(target, mode);
+
+    if (target == dir)
+	return false;
+    if (target->index >= graph.count)
+	return false;				/* Not in the list of services */
+    if ((peg->run.lvl & ptrg->run.lvl) == 0)
+	return false;				/* Not same boot level */
+
+    /*
+     * Only the order between two `$all' services is known
+     */
+    if (mode == 'K') {
+	if ((attof(target)->flags & SERV_FIRST) && !(attof(dir)->flags & SERV_FIRST)) {
+	    if (report) {
+		warn("Stopping %s depends on %s and therefore on system facility `$all' which can not be true!\n",
+		     dir->script ? dir->script : dir->name, target->script ? target->script : target->name);
+		order_warned = true;
+	    }
+	    return false;
+	}
+    } else {
+	if ((attof(dir)->flags & SERV_ALL) && !(attof(target)->flags & SERV_ALL)) {
+	    if (report) {
+		warn("Starting %s depends on %s and therefore on system facility `$all' which can not be true!\n",
+		     target->script ? target->script : target->name, dir->script ? dir->script : dir->name);
+		order_warned = true;
+	    }
+	    return false;
+	}
+    }
+    return true;
+}
+
+/*
+ * Calculate the order of all services or, if from is given, only
+ * of those reachable from it just like __follow() for setorder().
+ */
+#define DONE	UINT_MAX
+static void linear_follow(dir_t *restrict const from, const char mode)
+{
+    const adjacency_t * adj, * rev;
+    dir_t ** node;
+    uint * pending, * queue;
+    uint count, total, head = 0, tail = 0, seek = 0, n, e;
+
+    freeze();
+    if (!(count = graph.count))
+	goto out;
+    node = graph.node;
+    adj = getadj(mode);
+    rev = getradj(mode);
+
+    if (posix_memalign((void*)&pending, sizeof(void*), count * sizeof(uint)) != 0 ||
+	posix_memalign((void*)&queue, sizeof(void*), count * sizeof(uint)) != 0)
+	error("%s", strerror(errno));
+
+    if (from) {
+	/*
+	 * Only the services reachable from the given one
+	 * are involved, all others are already done.
+	 */
+	for (n = 0; n < count; n++)
+	    pending[n] = DONE;
+	pending[from->index] = 0;
+	queue[tail++] = from->index;
+
+	while (head < tail) {
+	    dir_t * dir = node[queue[head++]];
+
+	    for_each_edge(e, adj, dir->index) {
+		dir_t * target = node[adj->edge[e]];
+		if (!uselink(dir, target, mode, false))
+		    continue;
+		if (pending[target->index] == DONE) {
+		    pending[target->index] = 0;
+		    queue[tail++] = target->index;
+		}
+	    }
+	}
+	total = tail;
+
+	/*
+	 * Count the links from reached services only by
+	 * following the reverse links of the reached ones.
+	 */
+	for (head = 0; head < total; head++) {
+	    dir_t * dir = node[queue[head]];
+
+	    for_each_edge(e, rev, dir->index) {
+		if (pending[rev->edge[e]] == DONE)
+		    continue;
+		if (uselink(node[rev->edge[e]], dir, mode, false))
+		    pending[dir->index]++;
+	    }
+	}
+	head = tail = 0;
+    } else {
+	memset(pending, 0, count * sizeof(uint));
+	total = count;
+
+	for (n = 0; n < count; n++) {
+	    for_each_edge(e, adj, n) {
+		dir_t * target = node[adj->edge[e]];
+		if (uselink(node[n], target, mode, true))
+		    pending[target->index]++;
+	    }
+	}
+    }
+
+    for (n = 0; n < count; n++)
+	if (!pending[n])
+	    queue[tail++] = n;
+
+    while (head < total) {
+	handle_t * peg;
+	dir_t * dir;
+	int deep;
+
+	if (head == tail) {
+	    /*
+	     * Only services within a loop are left, break the
+	     * loop at the first of them in the list of services.
+	     */
+	    while (pending[seek] == 0 || pending[seek] == DONE)
+		seek++;
+	    peg = gethandle(node[seek], mode);
+	    if (!loops_reported)
+		warn("There is a loop at service %s if %s\n", peg->name, (mode == 'K') ? "stopped" : "started");
+	    peg->flags |= DIR_LOOPREPORT;
+	    order_warned = true;
+	    pending[seek] = 0;
+	    queue[tail++] = seek;
+	}
+
+	n = queue[head++];
+	pending[n] = DONE;
+	dir = node[n];
+	peg = gethandle(dir, mode);
+	stats_add(CNT_ORDER, 1);
+
+	if (peg->run.lvl == 0)
+	    continue;				/* Not in any boot level */
+
+	if (peg->deep < peg->mindeep)
+	    peg->deep = peg->mindeep;
+
+	if ((peg->run.lvl & LVL_ALL) && maxorder && (*maxorder < peg->deep))
+	    *maxorder = peg->deep;
+
+	deep = peg->deep;
+	if (*peg->name == '$') {
+	    if (adj->first[n] != adj->first[n+1]) {
+		warn("System facilities not fully expanded, see %s!\n", dir->name);
+		order_warned = true;
+	    }
+	} else if (++deep > MAX_DEEP) {
+	    if (adj->first[n] != adj->first[n+1] && (peg->flags & DIR_MAXDEEP) == 0)
+		warn("Max recursions depth %d for %s reached\n", MAX_DEEP, peg->name);
+	    order_warned = true;
+	    peg->flags |= DIR_MAXDEEP;
+	    deep = MAX_DEEP;
+	}
+
+	for_each_edge(e, adj, n) {
+	    dir_t * target = node[adj->edge[e]];
+	    handle_t * ptrg;
+
+	    if (!uselink(dir, target, mode, false))
+		continue;
+	    ptrg = gethandle(target, mode);
+	    if (ptrg->deep < deep)
+		ptrg->deep = deep;
+	    if (pending[target->index] != DONE && --pending[target->index] == 0)
+		queue[tail++] = target->index;
+	}
+    }
+
+    free(queue);
+    free(pending);
+out:
+    return;
+}
+#undef DONE
+
+/*
+ * The links followed by the ordering engine in use: __follow() skips
+ * all links from `$all' services if started and all links to them if
+ * stopped, and compares the boot levels of both ends with those of
+ * the service it has started with.
+ */
+static ushort looplvl;
+static boolean looplink(dir_t *restrict const dir, dir_t *restrict const target,
+			const char mode) attribute((nonnull(1,2)));
+static boolean looplink(dir_t *restrict const dir, dir_t *restrict const target,
+			const char mode)
+{
+    if (linear_order)
+	return uselink(dir, target, mode, false);
+
+    if (target == dir)
+	return false;
+    if (target->index >= graph.count)
+	return false;				/* Not in the list of services */
+    if ((gethandle(dir, mode)->run.lvl & looplvl) == 0)
+	return false;				/* Not same boot level as the root */
+    if ((gethandle(target, mode)->run.lvl & looplvl) == 0)
+	return false;
+    if (mode == 'K')
+	return !(attof(target)->flags & SERV_FIRST);
+    return !(attof(dir)->flags & SERV_ALL);
+}
+
+/*
+ * Search for loops within the start and stop dependencies with the
+ * algorithm of Tarjan for strongly connected components.  The same
+ * links as for the ordering are used and each loop is reported once
+ * with all its members and the LSB header fields causing the links.
+ */
+static const char * linkfield(const ushort origin, const char mode) attribute((const));
+static const char * linkfield(const ushort origin, const char mode)
+{
+    if (origin & REQ_REV)
+	return (mode == 'K') ? "X-Stop-After" : "X-Start-Before";
+    if (origin & REQ_MUST)
+	return (mode == 'K') ? "Required-Stop" : "Required-Start";
+    if (origin & REQ_ALL)
+	return (mode == 'K') ? "Required-Stop: $all" : "Required-Start: $all";
+    if (origin & REQ_SHLD)
+	return (mode == 'K') ? "Should-Stop" : "Should-Start";
+    return "current order";
+}
+
+static inline const char * dirscript(const dir_t *restrict const dir) attribute((always_inline,nonnull(1)));
+static inline const char * dirscript(const dir_t *restrict const dir)
+{
+    return dir->script ? dir->script : dir->name;
+}
+
+static void report_loop(const uint *restrict const member, const uint size,
+			const uint *restrict const comp, const uint id,
+			const char mode) attribute((nonnull(1,3)));
+static void report_loop(const uint *restrict const member, const uint size,
+			const uint *restrict const comp, const uint id,
+			const char mode)
+{
+    const adjacency_t * adj = getadj(mode);
+    uint n, e;
+
+    warn("There is a loop of %u services if %s:\n", size, (mode == 'K') ? "stopped" : "started");
+    for (n = 0; n < size; n++) {
+	dir_t * dir = graph.node[member[n]];
+
+	gethandle(dir, mode)->flags |= DIR_LOOPREPORT;
+
+	for_each_edge(e, adj, member[n]) {
+	    dir_t * target = graph.node[adj->edge[e]];
+	    const dir_t * owner;
+
+	    if (!looplink(dir, target, mode))
+		continue;
+	    if (comp[target->index] != id)
+		continue;
+
+	    /*
+	     * Forward requests are found in the header of the later
+	     * service, reversed ones in the header of the former.
+	     */
+	    if (!!(adj->origin[e] & REQ_REV) != (mode == 'K'))
+		owner = dir;
+	    else
+		owner = target;
+
+	    warn("  %s %s before %s (%s of %s)\n", dirscript(dir),
+		 (mode == 'K') ? "stopped" : "started", dirscript(target),
+		 linkfield(adj->origin[e], mode), dirscript(owner));
+	}
+    }
+}
+
+#define NONE	UINT_MAX
+static boolean tarjan(const char mode)
+{
+    const adjacency_t * adj;
+    dir_t ** node;
+    uint * order, * low, * comp, * stack, * call, * next;
+    uint count, depth = 0, top = 0, visit = 0, id = 0, n;
+    boolean ret = false;
+
+    freeze();
+    if (!(count = graph.count))
+	goto out;
+    node = graph.node;
+    adj = getadj(mode);
+
+    if (posix_memalign((void*)&order, sizeof(void*), count * sizeof(uint)) != 0 ||
+	posix_memalign((void*)&low,   sizeof(void*), count * sizeof(uint)) != 0 ||
+	posix_memalign((void*)&comp,  sizeof(void*), count * sizeof(uint)) != 0 ||
+	posix_memalign((void*)&stack, sizeof(void*), count * sizeof(uint)) != 0 ||
+	posix_memalign((void*)&call,  sizeof(void*), count * sizeof(uint)) != 0 ||
+	posix_memalign((void*)&next,  sizeof(void*), count * sizeof(uint)) != 0)
+	error("%s", strerror(errno));
+
+    for (n = 0; n < count; n++) {
+	order[n] = NONE;
+	comp[n] = NONE;
+    }
+
+    for (n = 0; n < count; n++) {
+	if (order[n] != NONE)
+	    continue;
+
+	order[n] = low[n] = visit++;
+	stack[top++] = n;
+	call[depth] = n;
+	next[depth++] = adj->first[n];
+
+	while (depth) {
+	    const uint v = call[depth-1];
+	    boolean descend = false;
+
+	    while (next[depth-1] < adj->first[v+1]) {
+		dir_t * target = node[adj->edge[next[depth-1]++]];
+		uint w;
+
+		if (!looplink(node[v], target, mode))
+		    continue;
+
+		w = target->index;
+		if (order[w] == NONE) {
+		    order[w] = low[w] = visit++;
+		    stack[top++] = w;
+		    call[depth] = w;
+		    next[depth++] = adj->first[w];
+		    descend = true;
+		    break;
+		}
+		if (comp[w] == NONE && low[v] > order[w])
+		    low[v] = order[w];
+	    }
+	    if (descend)
+		continue;
+
+	    if (low[v] == order[v]) {
+		uint size = 0;
+
+		do
+		    comp[stack[top - ++size]] = id;
+		while (stack[top - size] != v);
+
+		if (size > 1) {
+		    uint m;
+		    for (m = top - size; m < top; m++)
+			if (!(gethandle(node[stack[m]], mode)->flags & DIR_LOOPREPORT))
+			    break;
+		    if (m < top)		/* Not already told for an other root */
+			report_loop(&stack[top - size], size, comp, id, mode);
+		    ret = true;
+		}
+		top -= size;
+		id++;
+	    }
+
+	    if (--depth) {
+		const uint u = call[depth-1];
+		if (low[u] > low[v])
+		    low[u] = low[v];
+	    }
+	}
+    }
+
+    free(next);
+    free(call);
+    free(stack);
+    free(comp);
+    free(low);
+    free(order);
+out:
+    return ret;
+}
+#undef NONE
 
-	    if (min > *order)
-		min = *order;
+/*
+ * Buckets of linked lists, one for each possible start or stop
+ * deep, and a bit map of the buckets which are not empty.
+ */
+#define BUCKETS		(UCHAR_MAX+1)
+#define BITS		(CHAR_BIT*sizeof(ulong))
+typedef struct bucket_struct {
+    list_t    head[BUCKETS];
+    ulong     used[BUCKETS/BITS];
+} bucket_t;
+
+static inline void bucket_add(bucket_t *restrict b, list_t *restrict entry, const uchar deep) attribute((always_inline,nonnull(1,2)));
+static inline void bucket_add(bucket_t *restrict b, list_t *restrict entry, const uchar deep)
+{
+    if (!(b->used[deep/BITS] & (1UL << (deep%BITS)))) {
+	b->used[deep/BITS] |= (1UL << (deep%BITS));
+	initial(&b->head[deep]);
+    }
+    move_tail(entry, &b->head[deep]);
+}
 
-	    lvl |= ptmp->run.lvl;
+/*
+ * Put all buckets in front of the list, in increasing order of deep
+ * if up is set otherwise in decreasing order.  All buckets are empty
+ * afterwards.
+ */
+static void bucket_join(bucket_t *restrict b, list_t *restrict head, const boolean up) attribute((nonnull(1,2)));
+static void bucket_join(bucket_t *restrict b, list_t *restrict head, const boolean up)
+{
+    uint word;
+
+    if (up) {
+	for (word = BUCKETS/BITS; word-- > 0;) {
+	    while (b->used[word]) {
+		const int bit = BITS - 1 - __builtin_clzl(b->used[word]);
+		b->used[word] &= ~(1UL << bit);
+		join(&b->head[word*BITS + bit], head);
+	    }
 	}
-	if (min > 1) {		/* Set guessed order of this unknown script */
-	    uchar * order = &peg->deep;
-	    *order = min - 1;
-	    peg->run.lvl |= lvl;	/* Set guessed runlevels of this unknown script */
-	} else {
-	    peg->run.lvl  = LVL_BOOT;
+    } else {
+	for (word = 0; word < BUCKETS/BITS; word++) {
+	    while (b->used[word]) {
+		const int bit = __builtin_ctzl(b->used[word]);
+		b->used[word] &= ~(1UL << bit);
+		join(&b->head[word*BITS + bit], head);
+	    }
 	}
     }
-out:
-    return;
 }
 
 /*
  * Sort linked list of provides into start or stop order
  * during this set new start or stop order of the serives.
+ * The services are distributed into buckets of their order,
+ * a bit for each service marks if it is already resorted.
  */
 #define getdep(req)    ((dir_t*)(req)->serv->dir)
+#define getdeep(dir)   ((type == 'K') ? (dir)->stopp.deep : (dir)->start.deep)
 void lsort(const char type)
 {
-    list_t sort = { &sort, &sort };
+    const int maxorder = (type == 'K') ? maxstop : maxstart;
+    bucket_t *restrict bucket;
+    ulong *restrict seen;
     list_t * ptr, * safe, * this;
-    int order;
-
-    switch (type) {
-    case 'K':
-	for (order = 0; order <= maxstop; order++) {
-	    list_for_each_safe(ptr, safe, d_start) {
-		dir_t * dir = getdir(ptr);
-		if (dir->stopp.deep == order)
-		    move_tail(ptr, &sort);
-	    }
-	}
-	join(&sort, d_start);
-	list_for_each(this, s_start) {
-	    service_t * serv = getservice(this);
-	    if (serv->attr.flags & SERV_DUPLET)
+    uint count = 0;
+
+    thaw();				/* The list of dirs will be reordered */
+
+    if (posix_memalign((void*)&bucket, sizeof(void*), sizeof(bucket_t)) != 0)
+	error("%s", strerror(errno));
+    memset(bucket->used, 0, sizeof(bucket->used));
+
+    list_for_each_safe(ptr, safe, d_start) {
+	dir_t * dir = getdir(ptr);
+	dir->index = count++;
+	if (getdeep(dir) <= maxorder)
+	    bucket_add(bucket, ptr, getdeep(dir));
+    }
+    bucket_join(bucket, d_start, true);
+
+    if (posix_memalign((void*)&seen, sizeof(void*), (count/BITS + 1) * sizeof(ulong)) != 0)
+	error("%s", strerror(errno));
+    memset(seen, 0, (count/BITS + 1) * sizeof(ulong));
+
+    list_for_each(this, s_start) {
+	service_t * serv = getservice(this);
+	list_t * sort;
+
+	if (serv->attr.flags & SERV_DUPLET)
+	    continue;
+	sort = (type == 'K') ? &serv->sort.rev : &serv->sort.req;
+
+	list_for_each_safe(ptr, safe, sort) {
+	    req_t * req = getreq(ptr);
+	    dir_t * dir = getdep(req);
+	    service_t * orig;
+
+	    if (getdeep(dir) > maxorder)
+		continue;
+
+	    if (seen[dir->index/BITS] & (1UL << (dir->index%BITS))) {
+		delete(ptr);			/* already included */
+		edge_del(sort, req->serv, req);
+		pool_put(&pool_req, req);
 		continue;
-	    initial(&sort);
-	    for (order = maxstop; order >= 0; order--) {
-		list_for_each_safe(ptr, safe, &serv->sort.rev) {
-		    req_t * rev = getreq(ptr);
-		    dir_t * dir = getdep(rev);
-		    if (dir->stopp.deep == order) {
-			service_t *const orig = getorig(rev->serv);
-			list_t * chk;
-			boolean found = false;
-
-			list_for_each_prev(chk, &sort) {    /* check if service was already resorted */
-			    req_t * this = getreq(chk);
-			    if (getdep(this)->stopp.deep != order)
-				break;			    /* added on tail always with same order */
-			    if (getdep(this) == orig->dir) {
-				found = true;
-			    }
-			}
-
-			if (!found) {
-			    if (rev->serv != orig) {	    /* replace alias with its original */
-				req_t *restrict this;
-				if (posix_memalign((void*)&this, sizeof(void*), alignof(req_t)) != 0)
-				    error("%s", strerror(errno));
-				memset(this, 0, alignof(req_t));
-				this->flags = rev->flags;
-				this->serv = orig;
-				replace(ptr, &this->list);
-				ptr = &this->list;
-				free(rev);
-			    }
-			    move_tail(ptr, &sort);
-			} else {			    /* already included */
-			    delete(ptr);
-			    free(rev);
-			}
-		    }
-		}
 	    }
-	    join(&sort, &serv->sort.rev);
-	}
-	break;
-    default:
-	for (order = 0; order <= maxstart; order++) {
-	    list_for_each_safe(ptr, safe, d_start) {
-		dir_t * dir = getdir(ptr);
-		if (dir->start.deep == order)
-		    move_tail(ptr, &sort);
+	    seen[dir->index/BITS] |= (1UL << (dir->index%BITS));
+
+	    orig = getorig(req->serv);
+	    if (req->serv != orig) {		/* replace alias with its original */
+		req_t *restrict this = (req_t*)pool_get(&pool_req);
+		this->flags = req->flags;
+		this->serv = orig;
+		replace(ptr, &this->list);
+		ptr = &this->list;
+		edge_del(sort, req->serv, req);
+		edge_put(sort, orig, this);
+		pool_put(&pool_req, req);
 	    }
+	    bucket_add(bucket, ptr, getdeep(dir));
 	}
-	join(&sort, d_start);
-	list_for_each(this, s_start) {
-	    service_t * serv = getservice(this);
-	    if (serv->attr.flags & SERV_DUPLET)
-		continue;
-	    initial(&sort);
-	    for (order = maxstart; order >= 0; order--) {
-		list_for_each_safe(ptr, safe, &serv->sort.req) {
-		    req_t * req = getreq(ptr);
-		    dir_t * dir = getdep(req);
-		    if (dir->start.deep == order) {
-			service_t * orig = getorig(req->serv);
-			list_t * chk;
-			boolean found = false;
-
-			list_for_each_prev(chk, &sort) {    /* check if service was already resorted */
-			    req_t * this = getreq(chk);
-			    if (getdep(this)->start.deep != order)
-				break;			    /* added on tail always with same order */
-			    if (getdep(this) == orig->dir) {
-				found = true;
-				break;
-			    }
-			}
-
-			if (!found) {
-			    if (req->serv != orig) {	    /* replace alias with its original */
-				req_t *restrict this;
-				if (posix_memalign((void*)&this, sizeof(void*), alignof(req_t)) != 0)
-				    error("%s", strerror(errno));
-				memset(this, 0, alignof(req_t));
-				this->flags = req->flags;
-				this->serv = orig;
-				replace(ptr, &this->list);
-				ptr = &this->list;
-				free(req);
-			    }
-			    move_tail(ptr, &sort);
-			} else {			    /* already included */
-			    delete(ptr);
-			    free(req);
-			}
-		    }
-		}
-	    }
-	    join(&sort, &serv->sort.req);
+
+	bucket_join(bucket, sort, false);
+
+	list_for_each(ptr, sort) {		/* reset the marks for the next service */
+	    dir_t * dir = getdep(getreq(ptr));
+	    seen[dir->index/BITS] &= ~(1UL << (dir->index%BITS));
 	}
-	break;
     }
+
+    free(seen);
+    free(bucket);
 }
+#undef getdeep
+#undef BITS
+#undef BUCKETS
 
 /*
  * Clear out aliases of existing services, that is that for *one* script there
@@ -674,6 +1557,8 @@ void nickservice(service_t *restrict orig, service_t *restrict nick)
     if (cmp->script && cmp->script != dir->script)
 	return;
 
+    thaw();
+
     list_for_each_safe(dent, safe, &cmp->start.link) {
 	link_t * link  = getlink(dent);
 	dir_t * target = link->target;
@@ -681,12 +1566,13 @@ void nickservice(service_t *restrict orig, service_t *restrict nick)
 	if (target == cmp)
 	    continue;
 
-	ln_sf(target, dir, 'S');
+	ln_sf(target, dir, 'S', link->origin);
 
 	/* remove the link from local link list but never free the target */
 
 	delete(dent);
-	free(link);
+	edge_del(&cmp->start.link, target, link);
+	pool_put(&pool_link, link);
     }
 
     list_for_each_safe(dent, safe, &cmp->stopp.link) {
@@ -696,12 +1582,13 @@ void nickservice(service_t *restrict orig, service_t *restrict nick)
 	if (target == cmp)
 	    continue;
 
-	ln_sf(target, dir, 'K');
+	ln_sf(target, dir, 'K', link->origin);
 
 	/* remove the link from local link list but never free the target */
 
 	delete(dent);
-	free(link);
+	edge_del(&cmp->stopp.link, target, link);
+	pool_put(&pool_link, link);
     }
 
     delete(&cmp->d_list);	/* remove alias entry from global service list */
@@ -718,49 +1605,34 @@ void nickservice(service_t *restrict orig, service_t *restrict nick)
     orig->attr.flags |= nick->attr.flags;
     nick->attr.flags |= SERV_DUPLET;
 
-    if (cmp->script && cmp->script != dir->script) {
-	free(nick->attr.script);
-	nick->attr.script = orig->attr.script;
-    }
-
     nick->dir   = (void*)dir;	/* remember main provide */
     nick->start = &dir->start.run;
     nick->stopp = &dir->stopp.run;
 
-    if (--cmp->ref <= 0) free(cmp);
+    if (--cmp->ref <= 0) pool_put(&pool_dir, cmp);
 
     list_for_each_safe(dent, safe, &nick->sort.req) {
 	req_t * this = getreq(dent);
-	boolean ok = true;
-	list_t * req;
-	list_for_each(req, &orig->sort.req) {
-	    if (!strcmp(this->serv->name,getreq(req)->serv->name)) {
-		ok = false;
-		break;
-	    }
+	delete(dent);
+	edge_del(&nick->sort.req, this->serv, this);
+	if (edge_get(&orig->sort.req, this->serv))
+	    pool_put(&pool_req, this);
+	else {
+	    insert(dent, orig->sort.req.prev);
+	    edge_put(&orig->sort.req, this->serv, this);
 	}
-	if (!ok) {
-	    delete(dent);
-	    free(this);
-	} else
-	    move_tail(dent, &orig->sort.req);
     }
 
     list_for_each_safe(dent, safe, &nick->sort.rev) {
 	req_t * this = getreq(dent);
-	boolean ok = true;
-	list_t * rev;
-	list_for_each(rev, &orig->sort.rev) {
-	    if (!strcmp(this->serv->name,getreq(rev)->serv->name)) {
-		ok = false;
-		break;
-	    }
+	delete(dent);
+	edge_del(&nick->sort.rev, this->serv, this);
+	if (edge_get(&orig->sort.rev, this->serv))
+	    pool_put(&pool_req, this);
+	else {
+	    insert(dent, orig->sort.rev.prev);
+	    edge_put(&orig->sort.rev, this->serv, this);
 	}
-	if (!ok) {
-	    delete(dent);
-	    free(this);
-	} else
-	    move_tail(dent, &orig->sort.rev);
     }
 }
 
@@ -768,6 +1640,8 @@ void clear_all(void)
 {
     list_t * this;
 
+    thaw();
+
     /*
      * Find dangling links in global service list and remove them
      * if we by detect the remove bit from set above in the flags.
@@ -790,14 +1664,15 @@ void clear_all(void)
 	    /* remove the link from local link list */
 
 	    delete(dent);
-	    free(link);
+	    edge_del(&dir->start.link, target, link);
+	    pool_put(&pool_link, link);
 
  	    /* 
 	     * Do not free allocated strings and structure if in use
 	     * never free cmp->attr.script as this remains always in use.
 	     */
 
-	    if (--target->ref <= 0) free(target);
+	    if (--target->ref <= 0) pool_put(&pool_dir, target);
 	}
 
 	list_for_each_safe(dent, hold, &dir->stopp.link) {
@@ -813,14 +1688,15 @@ void clear_all(void)
 	    /* remove the link from local link list */
 
 	    delete(dent);
-	    free(link);
+	    edge_del(&dir->stopp.link, target, link);
+	    pool_put(&pool_link, link);
 
  	    /* 
 	     * Do not free allocated strings and structure if in use
 	     * never free cmp->attr.script as this remains always in use.
 	     */
 
-	    if (--target->ref <= 0) free(target);
+	    if (--target->ref <= 0) pool_put(&pool_dir, target);
 	}
     }
 #if defined(DEBUG) && (DEBUG > 0)
@@ -848,45 +1724,33 @@ void clear_all(void)
 
 	    list_for_each_safe(dent, safe, &orv->sort.req) {
 		req_t * this = getreq(dent);
-		boolean ok = true;
-		list_t * req;
-		list_for_each(req, &srv->sort.req) {
-		    if (!strcmp(this->serv->name,getreq(req)->serv->name)) {
-			ok = false;
-			break;
-		    }
-		}
-		if (!ok) {
+		delete(dent);
+		edge_del(&orv->sort.req, this->serv, this);
+		if (edge_get(&srv->sort.req, this->serv)) {
 		   fprintf(stderr, "BUG: removed %s from start list of %s, missed getorig()?\n",
 			   this->serv->name, orv->name);
-		   delete(dent);
-		   free(this);
+		   pool_put(&pool_req, this);
 		} else {
 		   fprintf(stderr, "BUG: moved %s from start list of %s to %s, missed getorig()?\n",
 			   this->serv->name, orv->name, srv->name);
-		   move_tail(dent, &srv->sort.req);
+		   insert(dent, srv->sort.req.prev);
+		   edge_put(&srv->sort.req, this->serv, this);
 		}
 	    }
 
 	    list_for_each_safe(dent, safe, &orv->sort.rev) {
 		req_t * this = getreq(dent);
-		boolean ok = true;
-		list_t * rev;
-		list_for_each(rev, &srv->sort.rev) {
-		   if (!strcmp(this->serv->name,getreq(rev)->serv->name)) {
-			ok = false;
-			break;
-		   }
-		}
-		if (!ok) {
+		delete(dent);
+		edge_del(&orv->sort.rev, this->serv, this);
+		if (edge_get(&srv->sort.rev, this->serv)) {
 		   fprintf(stderr, "BUG: removed %s from start list of %s, missed getorig()?\n",
 			   this->serv->name, orv->name);
-		   delete(dent);
-		   free(this);
+		   pool_put(&pool_req, this);
 		} else {
 		   fprintf(stderr, "BUG: moved %s from start list of %s to %s, missed getorig()?\n",
 			   this->serv->name, orv->name, srv->name);
-		   move_tail(dent, &srv->sort.rev);
+		   insert(dent, srv->sort.rev.prev);
+		   edge_put(&srv->sort.rev, this->serv, this);
 		}
 	    }
 	}
@@ -895,21 +1759,554 @@ void clear_all(void)
 }
 
 /*
- * Follow all services and their dependencies recursivly.
+ * The order cache holds the graph and the order found by the linear
+ * ordering of a former run.  Services with other links, runlevels,
+ * or default deep than before and all services reachable from them
+ * in the former or in the current graph are ordered again, all others
+ * keep their former order.  Without loops this is the order found by
+ * linear_follow(), therefore the cache is written only if the ordering
+ * has not warned about anything.
+ */
+#define ORDER_MAGIC	"insserv order"
+#define ORDER_VERSION	1
+#define ORDER_FLAGS	(SERV_FIRST|SERV_ALL)
+#define NONE		UINT_MAX
+
+typedef struct order_head_struct {
+    char      magic[sizeof(ORDER_MAGIC)];
+    uint32_t		 version;
+    uint32_t		   count;	/* Number of services */
+    uint32_t	       links[2];	/* Number of start and stop links */
+    uint32_t		   names;	/* Size of the names */
+} order_head_t;
+
+typedef struct order_node_struct {
+    uint32_t		    name;	/* Offset into the names */
+    uint32_t	       first[2];	/* Offsets into the start and stop links */
+    ushort		  lvl[2];
+    ushort		   flags;	/* SERV_FIRST and SERV_ALL of the service */
+    uchar	      mindeep[2];
+    uchar		 base[2];	/* Deep before the ordering */
+    uchar		 deep[2];	/* Deep found by the ordering */
+} order_node_t;
+
+static uchar * order_base[2];	/* Deep of the services before the ordering */
+static uchar * order_deep[2];	/* Deep found by the ordering */
+static boolean order_dirty;	/* Graph or order differ from the cache */
+
+/*
+ * The deep given by a service to the services linked from it, or
+ * -1 if linear_follow() would warn about the links of the service.
+ */
+static int order_step(dir_t *restrict const dir, const char mode) attribute((nonnull(1)));
+static int order_step(dir_t *restrict const dir, const char mode)
+{
+    const adjacency_t * adj = getadj(mode);
+    const handle_t * peg = gethandle(dir, mode);
+    const boolean links = (adj->first[dir->index] != adj->first[dir->index+1]);
+    int deep = peg->deep;
+
+    if (*peg->name == '$')
+	return links ? -1 : deep;
+    if (++deep > MAX_DEEP)
+	return links ? -1 : MAX_DEEP;
+    return deep;
+}
+
+/*
+ * Order the services changed since the cache was written and those
+ * reachable from them, give all others the order found in the cache.
+ */
+static boolean order_cone(const order_head_t *restrict const cache, const order_node_t *restrict const old,
+			  const uint32_t *restrict const oedge, const uint *restrict const nmap,
+			  const uint *restrict const omap, const char mode) attribute((nonnull(1,2,3,4,5)));
+static boolean order_cone(const order_head_t *restrict const cache, const order_node_t *restrict const old,
+			  const uint32_t *restrict const oedge, const uint *restrict const nmap,
+			  const uint *restrict const omap, const char mode)
+{
+    const uint h = (mode == 'K') ? 1 : 0;
+    const uint count = graph.count;
+    const adjacency_t * adj = getadj(mode);
+    const adjacency_t * rev = getradj(mode);
+    dir_t ** node = graph.node;
+    uint * pending, * queue, * stamp;
+    uint total, head = 0, tail = 0, done = 0, n, e, o;
+    boolean ret = false;
+
+    if (posix_memalign((void*)&pending, sizeof(void*), count * sizeof(uint)) != 0 ||
+	posix_memalign((void*)&queue, sizeof(void*), count * sizeof(uint)) != 0 ||
+	posix_memalign((void*)&stamp, sizeof(void*), count * sizeof(uint)) != 0)
+	error("%s", strerror(errno));
+
+    /*
+     * Find the services with other links or attributes than
+     * in the cache, each link set is compared with stamps.
+     */
+    for (n = 0; n < count; n++) {
+	pending[n] = NONE;
+	stamp[n] = NONE;
+    }
+    for (n = 0; n < count; n++) {
+	dir_t * dir = node[n];
+	const handle_t * peg = gethandle(dir, mode);
+	uint links = 0, seen = 0;
+
+	if ((o = nmap[n]) == NONE)
+	    goto changed;
+	if (old[o].lvl[h] != peg->run.lvl || old[o].mindeep[h] != peg->mindeep ||
+	    old[o].base[h] != order_base[h][n] || old[o].flags != (attof(dir)->flags & ORDER_FLAGS))
+	    goto changed;
+	for_each_edge(e, adj, n) {
+	    const uint t = adj->edge[e];
+	    if (t >= count || stamp[t] == 2*n)
+		continue;
+	    stamp[t] = 2*n;
+	    links++;
+	}
+	for (e = old[o].first[h]; e < old[o+1].first[h]; e++) {
+	    const uint t = omap[oedge[e]];
+	    if (t == NONE)
+		goto changed;
+	    if (stamp[t] == 2*n+1)
+		continue;
+	    if (stamp[t] != 2*n)
+		goto changed;
+	    stamp[t] = 2*n+1;
+	    seen++;
+	}
+	if (seen == links)
+	    continue;
+    changed:
+	pending[n] = 0;
+	queue[tail++] = n;
+	order_dirty = true;
+    }
+
+    /*
+     * The services linked from a service gone away
+     */
+    for (o = 0; o < cache->count; o++) {
+	if (omap[o] != NONE)
+	    continue;
+	order_dirty = true;
+	for (e = old[o].first[h]; e < old[o+1].first[h]; e++) {
+	    if ((n = omap[oedge[e]]) == NONE || pending[n] != NONE)
+		continue;
+	    pending[n] = 0;
+	    queue[tail++] = n;
+	}
+    }
+
+    /*
+     * Add all services reachable by the current or by the former links
+     */
+    while (head < tail) {
+	n = queue[head++];
+	for_each_edge(e, adj, n) {
+	    const uint t = adj->edge[e];
+	    if (t >= count || pending[t] != NONE)
+		continue;
+	    pending[t] = 0;
+	    queue[tail++] = t;
+	}
+	if ((o = nmap[n]) == NONE)
+	    continue;
+	for (e = old[o].first[h]; e < old[o+1].first[h]; e++) {
+	    const uint t = omap[oedge[e]];
+	    if (t == NONE || pending[t] != NONE)
+		continue;
+	    pending[t] = 0;
+	    queue[tail++] = t;
+	}
+    }
+    total = tail;
+
+    for (n = 0; n < count; n++) {
+	if (pending[n] == NONE)
+	    gethandle(node[n], mode)->deep = old[nmap[n]].deep[h];
+    }
+
+    /*
+     * Count the links within the services to be ordered, the links
+     * from the others give their deep at once.
+     */
+    for (head = 0; head < total; head++) {
+	dir_t * dir = node[queue[head]];
+	handle_t * peg = gethandle(dir, mode);
+
+	for_each_edge(e, rev, dir->index) {
+	    const uint p = rev->edge[e];
+	    int deep;
+
+	    if (p >= count)
+		continue;
+	    if (!uselink(node[p], dir, mode, false)) {
+		if (p != dir->index && (gethandle(node[p], mode)->run.lvl & peg->run.lvl))
+		    goto out;			/* linear_follow() warns about `$all' */
+		continue;
+	    }
+	    if (pending[p] != NONE) {
+		pending[dir->index]++;
+		continue;
+	    }
+	    if ((deep = order_step(node[p], mode)) < 0)
+		goto out;
+	    if (peg->deep < deep)
+		peg->deep = deep;
+	}
+    }
+
+    head = tail = 0;
+    for (n = 0; n < total; n++) {
+	if (pending[queue[n]] == 0)
+	    stamp[tail++] = queue[n];
+    }
+
+    while (head < tail) {
+	dir_t * dir = node[stamp[head++]];
+	handle_t * peg = gethandle(dir, mode);
+	int deep;
+
+	done++;
+	stats_add(CNT_ORDER, 1);
+
+	if (peg->run.lvl == 0)
+	    continue;				/* Not in any boot level */
+
+	if (peg->deep < peg->mindeep)
+	    peg->deep = peg->mindeep;
+
+	if ((deep = order_step(dir, mode)) < 0)
+	    goto out;
+
+	for_each_edge(e, adj, dir->index) {
+	    dir_t * target = node[adj->edge[e]];
+	    handle_t * ptrg;
+
+	    if (!uselink(dir, target, mode, false))
+		continue;
+	    ptrg = gethandle(target, mode);
+	    if (ptrg->deep < deep)
+		ptrg->deep = deep;
+	    if (--pending[target->index] == 0)
+		stamp[tail++] = target->index;
+	}
+    }
+    ret = (done == total);			/* Otherwise there is a loop */
+out:
+    free(stamp);
+    free(queue);
+    free(pending);
+    return ret;
+}
+
+/*
+ * Use the cache to order the services, if this is not possible
+ * nothing is changed.
+ */
+static boolean order_load(const char *restrict const file) attribute((nonnull(1)));
+static boolean order_load(const char *restrict const file)
+{
+    const uint count = graph.count;
+    const order_head_t * cache;
+    const order_node_t * old;
+    const uint32_t * oedge[2];
+    const char * names;
+    uint * nmap = (uint*)0, * omap = (uint*)0;
+    hash_t index = { 0, 0, (struct hash_entry*)0 };
+    boolean ret = false;
+    struct stat st;
+    size_t size;
+    void * map;
+    uint n, o, h;
+    int fd;
+
+    stats_add(CNT_OPEN, 1);
+    if ((fd = open(file, O_RDONLY|O_CLOEXEC)) < 0)
+	return false;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(order_head_t))
+	goto out;
+    size = (size_t)st.st_size;
+    if ((map = mmap((void*)0, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+	goto out;
+
+    cache = (const order_head_t*)map;
+    if (memcmp(cache->magic, ORDER_MAGIC, sizeof(ORDER_MAGIC)) || cache->version != ORDER_VERSION)
+	goto unmap;
+    if (size != sizeof(order_head_t) + ((size_t)cache->count + 1) * sizeof(order_node_t) +
+		((size_t)cache->links[0] + cache->links[1]) * sizeof(uint32_t) + cache->names)
+	goto unmap;
+    old = (const order_node_t*)(cache + 1);
+    oedge[0] = (const uint32_t*)(old + cache->count + 1);
+    oedge[1] = oedge[0] + cache->links[0];
+    names = (const char*)(oedge[1] + cache->links[1]);
+    if (cache->names == 0 || names[cache->names - 1] != '\0')
+	goto unmap;
+
+    for (h = 0; h < 2; h++) {
+	if (old[0].first[h] != 0 || old[cache->count].first[h] != cache->links[h])
+	    goto unmap;
+	for (o = 0; o < cache->count; o++) {
+	    if (old[o].first[h] > old[o+1].first[h])
+		goto unmap;
+	}
+	for (n = 0; n < cache->links[h]; n++) {
+	    if (oedge[h][n] >= cache->count)
+		goto unmap;
+	}
+    }
+
+    if (!(nmap = (uint*)malloc((count + 1) * sizeof(uint))) ||
+	!(omap = (uint*)malloc((cache->count + 1) * sizeof(uint))))
+	error("%s", strerror(errno));
+
+    /*
+     * Services are the same if their names are the same
+     */
+    for (o = 0; o < cache->count; o++) {
+	void ** slot;
+	if (old[o].name >= cache->names)
+	    goto free;
+	slot = hash_put(&index, names + old[o].name);
+	if (*slot)
+	    goto free;
+	*slot = (void*)&old[o];
+	omap[o] = NONE;
+    }
+    for (n = 0; n < count; n++) {
+	const order_node_t * this = (const order_node_t*)hash_get(&index, graph.node[n]->name);
+	nmap[n] = NONE;
+	if (!this)
+	    continue;
+	o = this - old;
+	if (omap[o] != NONE)
+	    goto free;
+	omap[o] = n;
+	nmap[n] = o;
+    }
+
+    if (!order_cone(cache, old, oedge[0], nmap, omap, 'S') ||
+	!order_cone(cache, old, oedge[1], nmap, omap, 'K'))
+	goto free;
+
+    for (n = 0; n < count; n++) {
+	const dir_t * dir = graph.node[n];
+	if ((dir->start.run.lvl & LVL_ALL) && (maxstart < dir->start.deep))
+	    maxstart = dir->start.deep;
+	if ((dir->stopp.run.lvl & LVL_ALL) && (maxstop < dir->stopp.deep))
+	    maxstop = dir->stopp.deep;
+    }
+    ret = true;
+free:
+    hash_free(&index);
+    free(omap);
+    free(nmap);
+unmap:
+    munmap(map, size);
+out:
+    close(fd);
+    return ret;
+}
+
+static void order_reset(void)
+{
+    uint n;
+
+    for (n = 0; n < graph.count; n++) {
+	graph.node[n]->start.deep = order_base[0][n];
+	graph.node[n]->stopp.deep = order_base[1][n];
+    }
+}
+
+static void linear_follow_all(void)
+{
+    maxorder = &maxstart;
+    linear_follow((dir_t*)0, 'S');
+    maxorder = &maxstop;
+    linear_follow((dir_t*)0, 'K');
+}
+
+/*
+ * Compare the order found with the cache with the order
+ * found by linear_follow() for all services.
+ */
+static void order_verify(const int start, const int stop)
+{
+    const int istart = maxstart, istop = maxstop;
+    uchar * deep;
+    uint n;
+
+    if (!(deep = (uchar*)malloc(2 * graph.count + 1)))
+	error("%s", strerror(errno));
+    for (n = 0; n < graph.count; n++) {
+	deep[2*n]   = graph.node[n]->start.deep;
+	deep[2*n+1] = graph.node[n]->stopp.deep;
+    }
+
+    order_reset();
+    maxstart = start;
+    maxstop  = stop;
+    linear_follow_all();
+
+    for (n = 0; n < graph.count; n++) {
+	const dir_t * dir = graph.node[n];
+	if (deep[2*n] != dir->start.deep || deep[2*n+1] != dir->stopp.deep)
+	    error("incremental order of %s is %d/%d but should be %d/%d\n", dir->name,
+		  deep[2*n], deep[2*n+1], dir->start.deep, dir->stopp.deep);
+    }
+    if (istart != maxstart || istop != maxstop)
+	error("incremental maximal order is %d/%d but should be %d/%d\n", istart, istop, maxstart, maxstop);
+    free(deep);
+    info(1, "incremental order of %u services verified\n", graph.count);
+}
+
+/*
+ * Write the graph and the order found to the cache
+ */
+void save_order(const char *restrict const file)
+{
+    const uint count = graph.count;
+    order_head_t cache;
+    char temp[PATH_MAX+1];
+    uint32_t off, first[2], h;
+    FILE * out;
+    uint n, e;
+    int fd;
+
+    if (!order_base[0])
+	return;
+    if (order_warned || !order_dirty)
+	goto out;
+
+    snprintf(temp, sizeof(temp), "%s.XXXXXX", file);
+    if ((fd = mkstemp(temp)) < 0 || !(out = fdopen(fd, "w"))) {
+	info(1, "can not write %s: %s\n", file, strerror(errno));
+	if (fd >= 0) {
+	    close(fd);
+	    unlink(temp);
+	}
+	goto out;
+    }
+    (void)fchmod(fd, 0644);
+
+    memset(&cache, 0, sizeof(cache));
+    memcpy(cache.magic, ORDER_MAGIC, sizeof(ORDER_MAGIC));
+    cache.version = ORDER_VERSION;
+    cache.count = count;
+    for (h = 0; h < 2; h++) {
+	const adjacency_t * adj = getadj(h ? 'K' : 'S');
+	for (n = 0; n < count; n++)
+	    for_each_edge(e, adj, n)
+		if (adj->edge[e] < count)
+		    cache.links[h]++;
+    }
+    for (n = 0; n < count; n++)
+	cache.names += strlen(graph.node[n]->name) + 1;
+    fwrite(&cache, sizeof(cache), 1, out);
+
+    for (n = 0, off = first[0] = first[1] = 0; n <= count; n++) {
+	order_node_t this;
+
+	memset(&this, 0, sizeof(this));
+	this.first[0] = first[0];
+	this.first[1] = first[1];
+	if (n < count) {
+	    const dir_t * dir = graph.node[n];
+
+	    this.name = off;
+	    off += strlen(dir->name) + 1;
+	    this.lvl[0] = dir->start.run.lvl;
+	    this.lvl[1] = dir->stopp.run.lvl;
+	    this.flags = attof(dir)->flags & ORDER_FLAGS;
+	    this.mindeep[0] = dir->start.mindeep;
+	    this.mindeep[1] = dir->stopp.mindeep;
+	    for (h = 0; h < 2; h++) {
+		const adjacency_t * adj = getadj(h ? 'K' : 'S');
+		this.base[h] = order_base[h][n];
+		this.deep[h] = order_deep[h][n];
+		for_each_edge(e, adj, n)
+		    if (adj->edge[e] < count)
+			first[h]++;
+	    }
+	}
+	fwrite(&this, sizeof(this), 1, out);
+    }
+    for (h = 0; h < 2; h++) {
+	const adjacency_t * adj = getadj(h ? 'K' : 'S');
+	for (n = 0; n < count; n++) {
+	    for_each_edge(e, adj, n) {
+		const uint32_t t = adj->edge[e];
+		if (t < count)
+		    fwrite(&t, sizeof(t), 1, out);
+	    }
+	}
+    }
+    for (n = 0; n < count; n++)
+	fwrite(graph.node[n]->name, sizeof(char), strlen(graph.node[n]->name) + 1, out);
+
+    if (fclose(out) != 0 || rename(temp, file) != 0) {
+	info(1, "can not write %s: %s\n", file, strerror(errno));
+	unlink(temp);
+    }
+out:
+    free(order_base[0]);
+    order_base[0] = order_base[1] = order_deep[0] = order_deep[1] = (uchar*)0;
+}
+
+/*
+ * Follow all services and their dependencies recursivly.  With
+ * an order cache only the services changed since the cache was
+ * written are ordered again, see order_load().
  */
-void follow_all(void)
+void follow_all(const char *restrict const cache, const boolean verify)
 {
+    const int start = maxstart, stop = maxstop;
     list_t *tmp;
+    uint n;
+
+    freeze();
+    order_warned = false;
+
+    if (cache) {
+	if (!(order_base[0] = (uchar*)malloc(4 * graph.count + 1)))
+	    error("%s", strerror(errno));
+	order_base[1] = order_base[0] + graph.count;
+	order_deep[0] = order_base[1] + graph.count;
+	order_deep[1] = order_deep[0] + graph.count;
+	for (n = 0; n < graph.count; n++) {
+	    order_base[0][n] = graph.node[n]->start.deep;
+	    order_base[1][n] = graph.node[n]->stopp.deep;
+	}
+	order_dirty = false;
+	if (order_load(cache)) {
+	    if (verify)
+		order_verify(start, stop);
+	    goto guess;
+	}
+	order_reset();
+	maxstart = start;
+	maxstop  = stop;
+	order_dirty = true;
+    }
 
     /*
      * Follow all scripts and calculate the main ordering.
      */
-    list_for_each(tmp, d_start) {
+    if (linear_order)
+	linear_follow_all();
+    else list_for_each(tmp, d_start) {
 	maxorder = &maxstart;
 	follow(getdir(tmp), 'S', 1);
 	maxorder = &maxstop;
 	follow(getdir(tmp), 'K', 1);
     }
+guess:
+    if (cache) {
+	for (n = 0; n < graph.count; n++) {
+	    order_deep[0][n] = graph.node[n]->start.deep;
+	    order_deep[1][n] = graph.node[n]->stopp.deep;
+	}
+    }
 
     /*
      * Guess order of not installed scripts in comparision
@@ -923,6 +2320,62 @@ void follow_all(void)
     }
 }
 
+/*
+ * Report all loops in the start and stop order at once.
+ */
+/*
+ * The legacy engine follows the links of each service with the boot
+ * levels of the service it has started with, therefore search once
+ * for each of the boot levels found.
+ */
+static boolean loop_search(const char mode)
+{
+    ushort * lvls;
+    uint count, n, m, k = 0;
+    boolean ret = false;
+
+    if (linear_order)
+	return tarjan(mode);
+
+    freeze();
+    if (!(count = graph.count))
+	goto out;
+    if (!(lvls = (ushort*)malloc(count * sizeof(ushort))))
+	error("%s", strerror(errno));
+
+    for (n = 0; n < count; n++) {
+	const ushort lvl = gethandle(graph.node[n], mode)->run.lvl;
+	if (!lvl)
+	    continue;
+	for (m = 0; m < k; m++)
+	    if (lvls[m] == lvl)
+		break;
+	if (m < k)
+	    continue;
+	lvls[k++] = lvl;
+	looplvl = lvl;
+	if (tarjan(mode))
+	    ret = true;
+    }
+
+    free(lvls);
+out:
+    return ret;
+}
+
+boolean detect_loops(void)
+{
+    boolean ret = false;
+
+    if (loop_search('S'))
+	ret = true;
+    if (loop_search('K'))
+	ret = true;
+
+    loops_reported = ret;
+    return ret;
+}
+
 boolean is_loop_detected(void)
 {
     list_t *tmp;
@@ -943,9 +2396,10 @@ void show_all()
 {
     list_t *tmp;
     if (maxstop > 0) list_for_each(tmp, d_start) {
-	char * script, *lvlstr;
+	const char * script;
+	char * lvlstr;
 #if defined(DEBUG) && (DEBUG > 0)
-	char *name;
+	const char *name;
 #endif
 	dir_t * dir = getdir(tmp);
 	handle_t * peg;
@@ -978,9 +2432,10 @@ void show_all()
 	xreset(lvlstr);
     }
     if (maxstart > 0) list_for_each(tmp, d_start) {
-	char * script, *lvlstr;
+	const char * script;
+	char * lvlstr;
 #if defined(DEBUG) && (DEBUG > 0)
-	char *name;
+	const char *name;
 #endif
 	dir_t * dir = getdir(tmp);
 	handle_t * peg;
@@ -1019,10 +2474,19 @@ void show_all()
  */
 boolean notincluded(const char *restrict const script, const char mode, const int runlevel)
 {
+    dir_t * dir = (dir_t*)hash_get(&scrpidx, script);
     list_t *tmp;
     boolean ret = false;
     const ushort lvl = map_runlevel_to_lvl (runlevel);
 
+    if (dir != SCRIPT_SHARED) {
+	if (dir) {
+	    level_t * run = (mode == 'K') ? &dir->stopp.run : &dir->start.run;
+	    ret = ((run->lvl & lvl) == 0);
+	}
+	goto out;
+    }
+
     list_for_each_prev(tmp, d_start) {
 	dir_t * dir = getdir(tmp);
 	level_t * run = (mode == 'K') ? &dir->stopp.run : &dir->start.run;
@@ -1039,7 +2503,7 @@ boolean notincluded(const char *restrict const script, const char mode, const in
 	ret = true;			/* Not included */
 	break;
     }
-
+out:
     return ret;
 }
 
@@ -1060,8 +2524,6 @@ service_t * listscripts(const char **restrict script, const char mode, const ush
 	serv = (service_t*)0;
 	if (tmp == d_start)
 	    break;
-	if (tmp->next)
-            prefetch(tmp->next);
 	dir = getdir(tmp);
 
 	attof(dir)->korder = dir->stopp.deep;
@@ -1092,9 +2554,9 @@ service_t * listscripts(const char **restrict script, const char mode, const ush
 /*
  * THIS services DEPENDS on that service befor startup or shutdown.
  */
-void requires(service_t *restrict this, service_t *restrict dep, const char mode)
+void requires(service_t *restrict this, service_t *restrict dep, const char mode, const ushort origin)
 {
-    ln_sf((dir_t*)this->dir, (dir_t*)dep->dir, mode);
+    ln_sf((dir_t*)this->dir, (dir_t*)dep->dir, mode, origin);
     if (this->attr.flags & SERV_SYSTEMD) {
 	dir_t *dir = (dir_t*)this->dir;
 	handle_t *peg = &dir->stopp;
@@ -1156,7 +2618,11 @@ void setorder(const char *restrict script, const char mode, const int order, con
     /*
      * Follow the script and re-calculate the ordering.
      */
-    __follow(dir, (dir_t*)0, peg->mindeep, mode, 0);
+    freeze();
+    if (linear_order)
+	linear_follow(dir, mode);
+    else
+	__follow(dir, (dir_t*)0, peg->mindeep, mode, 0);
 
     /*
      * Guess order of not installed scripts in comparision
@@ -1199,13 +2665,17 @@ boolean makeprov(service_t *restrict serv, const char *restrict script)
 
     if (!dir->script) {
 	list_t * ptr;
+	void ** slot;
 	if (!alias) {
-	    serv->attr.script = xstrdup(script);
+	    serv->attr.script = intern(script);
 	    serv->attr.flags |= SERV_SCRIPT;
 	    dir->script = serv->attr.script;
 	} else
 	    dir->script = alias->script;
 
+	slot = hash_put(&scrpidx, dir->script);
+	*slot = *slot ? SCRIPT_SHARED : (void*)dir;
+
 	list_for_each(ptr, s_start) {
 	    service_t * tmp = getservice(ptr);
 	    if (tmp == serv)
@@ -1218,7 +2688,7 @@ boolean makeprov(service_t *restrict serv, const char *restrict script)
 	    tmp->attr.flags |= SERV_SCRIPT;
 	}
 
-    } else if (strcmp(dir->script, script))
+    } else if (dir->script != intern(script))
 	ret = false;
 
     return ret;
@@ -1229,17 +2699,11 @@ boolean makeprov(service_t *restrict serv, const char *restrict script)
  */
 const char * getscript(const char *restrict prov)
 {
-    char * script = (char*)0;
-    list_t * ptr;
+    const service_t * this = (service_t*)hash_get(&servidx, prov);
+    const char * script = (char*)0;
 
-    list_for_each(ptr, s_start) {
-	service_t * this = getservice(ptr);
-	if (!strcmp(this->name, prov)) {
-	    if (this->attr.script)
-		script = this->attr.script;
-	    break;
-	}
-    }
+    if (this && this->attr.script)
+	script = this->attr.script;
     return script;
 }
 
@@ -1261,19 +2725,12 @@ const char * getprovides(const char *restrict script)
  */
 service_t * findservice(const char *restrict const name)
 {
-    list_t * ptr;
     service_t * ret = (service_t*)0;
 
     if (name == (const char*)0)
 	goto out;
 
-    list_for_each(ptr, s_start) {
-	service_t * this = getservice(ptr);
-	if (!strcmp(this->name, name)) {
-	    ret = this;
-	    break;
-	}
-    }
+    ret = (service_t*)hash_get(&servidx, name);
 out:
     return ret;
 }
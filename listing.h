@@ -58,47 +58,6 @@ typedef unsigned int uint;
 # define offsetof(type,memb)	__builtin_offsetof(type,memb)
 #endif
 
-/*
- * This is lent from the kernel by e.g. using
- *
- *   echo '#include <asm-i386/processor.h>\nint main () { prefetch(); return 0; }' | \
- *	gcc -I/usr/src/linux/include -D__KERNEL__ -x c -E -P - | \
- *	sed -rn '/void[[:blank:]]+prefetch[[:blank:]]*\(/,/^}/p'
- *
- * on the appropiate architecture (here on i686 for i586).
- */
-extern inline void attribute((used,__gnu_inline__,always_inline,)) prefetch(const void *restrict x)
-{
-#if   defined(__x86_64__)
-    asm volatile ("prefetcht0 %0"  :: "m" (*(unsigned long *)x))
-#elif defined(__ia64__)
-    asm volatile ("lfetch [%0]"    :: "r" (x))
-#elif defined(__powerpc64__)
-    asm volatile ("dcbt 0,%0"      :: "r" (x))
-#elif 1 && defined(__i386__)
-    asm volatile ("661:\n\t"
-		  ".byte 0x8d,0x74,0x26,0x00\n"
-		  "\n662:\n"
-		  ".section .altinstructions,\"a\"\n"
-		  "  .align 4\n"
-		  "  .long 661b\n"
-		  "  .long 663f\n"
-		  "  .byte %c0\n"
-		  "  .byte 662b-661b\n"
-		  "  .byte 664f-663f\n"
-		  ".previous\n"
-		  ".section .altinstr_replacement,\"ax\"\n"
-		  "   663:\n\t"
-		  "   prefetchnta (%1)"
-		  "   \n664:\n"
-		  ".previous"
-		  :: "i" ((0*32+25)), "r" (x))
-#else
-    __builtin_prefetch ((x), 0, 1);
-#endif
-    ;
-}
-
 #if defined(DEBUG) && (DEBUG > 0)
 # define __align attribute((packed))
 #else
@@ -238,13 +197,13 @@ static inline void move_tail(list_t *restrict entry, list_t *restrict head)
 	const typeof( ((type *)0)->member ) *__mptr = (ptr);	\
 	((type *)( (char *)(__mptr) - offsetof(type,member) )); }))
 #define list_for_each(pos, head)	\
-	for (pos = (head)->next; prefetch(pos->next), pos != (head); pos = pos->next)
+	for (pos = (head)->next; pos != (head); pos = pos->next)
 #define np_list_for_each(pos, head)	\
 	for (pos = (head)->next; pos != (head); pos = pos->next)
 #define list_for_each_safe(pos, safe, head)	\
 	for (pos = (head)->next, safe = pos->next; pos != (head); pos = safe, safe = pos->next)
 #define list_for_each_prev(pos, head)	\
-	for (pos = (head)->prev; prefetch(pos->prev), pos != (head); pos = pos->prev)
+	for (pos = (head)->prev; pos != (head); pos = pos->prev)
 #define np_list_for_each_prev(pos, head)	\
 	for (pos = (head)->prev; pos != (head); pos = pos->prev)
 
@@ -263,7 +222,7 @@ typedef struct attr_struct {
     short		    ref;
     uchar		 sorder;
     uchar		 korder;
-    char		*script;
+    const char		*script;
 } __packed attr_t;
 
 /*
@@ -294,19 +253,81 @@ struct service_struct {
     level_t	*restrict start;
     level_t	*restrict stopp;
     attr_t		   attr;
-    char		 * name;
+    const char		 * name;
 } __align;
 #define getservice(list)	list_entry((list), service_t, s_list)
 
+/*
+ * Open addressing hash table with string keys, used as an index
+ * beside the linked lists.  The keys are not copied, therefore
+ * they have to live as long as the table its self.
+ */
+typedef struct hash_struct {
+    uint		    size;	/* Number of slots, always a power of two */
+    uint		   count;	/* Number of used slots */
+    struct hash_entry {
+	const char	   * key;
+	void		   * val;
+    }			  * slot;
+} hash_t;
+
+extern void * hash_get(const hash_t *restrict const tab, const char *restrict const key) attribute((nonnull(1,2)));
+extern void ** hash_put(hash_t *restrict const tab, const char *restrict const key) attribute((nonnull(1,2)));
+extern void hash_free(hash_t *restrict const tab) attribute((nonnull(1)));
+
+/*
+ * Arena for the nodes of the dependency graph, all memory taken
+ * from it is released at once by arena_free().  Nodes of a fixed
+ * size are handed out by a pool which reuses the nodes given back.
+ */
+typedef struct pool_struct {
+    struct pool_struct	   * next;	/* Pools in use, null if not used yet */
+    void		   * free;	/* Nodes given back */
+    size_t		     size;
+} pool_t;
+#define POOL(type)	{ (pool_t*)0, (void*)0, alignof(type) }
+
+extern void * arena_alloc(size_t size) attribute((malloc));
+extern void * pool_grow(pool_t *restrict const pool) attribute((malloc,nonnull(1)));
+extern void arena_free(void);
+extern const char * intern(const char *restrict const name) attribute((nonnull(1)));
+extern void * edge_get(const void *restrict const list, const void *restrict const key) attribute((nonnull(1,2)));
+extern void edge_put(const void *restrict const list, const void *restrict const key, void *restrict const node) attribute((nonnull(1,2,3)));
+extern void edge_del(const void *restrict const list, const void *restrict const key, const void *restrict const node) attribute((nonnull(1,2,3)));
+
+static inline void * pool_get(pool_t *restrict const pool) attribute((always_inline,malloc,nonnull(1)));
+static inline void * pool_get(pool_t *restrict const pool)
+{
+    void * node = pool->free;
+    if (node)
+	pool->free = *(void**)node;
+    else
+	node = pool_grow(pool);
+    memset(node, 0, pool->size);
+    return node;
+}
+
+static inline void pool_put(pool_t *restrict const pool, void *restrict const node) attribute((always_inline,nonnull(1,2)));
+static inline void pool_put(pool_t *restrict const pool, void *restrict const node)
+{
+    *(void**)node = pool->free;
+    pool->free = node;
+}
+
+extern pool_t pool_req;
+
 extern list_t * s_start;
 extern int maxstart;
 extern int maxstop;
+extern boolean linear_order;
 
 extern void clear_all(void);
 extern void nickservice(service_t *restrict orig, service_t *restrict nick) attribute((nonnull(1,2)));
-extern void follow_all(void);
+extern void freeze(void);
+extern void follow_all(const char *restrict const cache, const boolean verify);
+extern void save_order(const char *restrict const file) attribute((nonnull(1)));
 extern void show_all(void);
-extern void requires(service_t *restrict this, service_t *restrict dep, const char mode) attribute((nonnull(1,2)));
+extern void requires(service_t *restrict this, service_t *restrict dep, const char mode, const ushort origin) attribute((nonnull(1,2)));
 extern void runlevels(service_t *restrict serv, const char mode, const char *restrict lvl) attribute((nonnull(1,3)));
 extern boolean makeprov(service_t *restrict serv, const char *restrict script) attribute((nonnull(1,2)));
 extern void setorder(const char *restrict script, const char mode, const int order, const boolean recursive) attribute((nonnull(1)));
@@ -316,6 +337,7 @@ extern const char * getscript(const char *restrict prov) attribute((nonnull(1)))
 extern const char * getprovides(const char *restrict script) attribute((nonnull(1)));
 extern service_t * listscripts(const char **restrict script, const char mode, const ushort lvl);
 extern boolean is_loop_detected(void);
+extern boolean detect_loops(void);
 extern service_t * addservice(const char *restrict const serv) attribute((malloc,nonnull(1)));
 extern service_t * findservice(const char *restrict const name);
 extern service_t * getorig(service_t *restrict serv) attribute((const,nonnull(1)));
@@ -328,6 +350,26 @@ extern const char *const delimeter;
 extern void error(const char *restrict fmt, ...) attribute((noreturn,format(printf,1,2)));
 extern void warn (const char *restrict fmt, ...) attribute((format(printf,1,2)));
 extern void info (int level, const char *restrict fmt, ...) attribute((format(printf,2,3)));
+
+/*
+ * Counters of the system calls and the work done, shown by --stats
+ */
+enum stats_counter {
+    CNT_STAT = 0,
+    CNT_LSTAT,
+    CNT_READLINK,
+    CNT_OPEN,
+    CNT_BYTES,
+    CNT_REGEXEC,
+    CNT_SYMLINK,
+    CNT_UNLINK,
+    CNT_URING,
+    CNT_ORDER,
+    CNT_MAX
+};
+extern boolean stats;
+extern ulong stats_count[CNT_MAX];
+#define stats_add(c,n)	(stats ? (void)__atomic_fetch_add(&stats_count[(c)], (n), __ATOMIC_RELAXED) : (void)0)
 int map_has_runlevels(void);
 char map_runlevel_to_key(const int runlevel);
 ushort map_key_to_lvl(const char key);
@@ -348,49 +390,60 @@ static inline char * xstrdup(const char *restrict s)
     return r;
 } 
 
+static inline char * xstrndup(const char *restrict s, const size_t n) attribute((always_inline,malloc));
+static inline char * xstrndup(const char *restrict s, const size_t n)
+{
+    char * r;
+    if (!s)
+	error("%s", strerror(EINVAL));
+    if (!(r = strndup(s, n)))
+	error("%s", strerror(errno));
+    return r;
+}
+
 extern char empty[];
 #define xreset(ptr)	\
 	{ if (ptr && empty != ptr) free(ptr);} ptr = NULL
 
 #if defined(HAS_unlinkat) && defined(_ATFILE_SOURCE) && !defined(__stub_unlinkat)
-# define xremove(d,x) (__extension__ ({ if ((dryrun ? 0 : \
-	(unlinkat(d,x,0) != 0 && (errno != EISDIR || unlinkat(d,x,AT_REMOVEDIR) != 0)))) \
+# define xremove(d,x) (__extension__ ({ if ((dryrun ? 0 : (stats_add(CNT_UNLINK,1), \
+	unlinkat(d,x,0) != 0 && (errno != EISDIR || unlinkat(d,x,AT_REMOVEDIR) != 0)))) \
 	warn ("can not remove(%s/%s%s): %s\n", path, rcd, x, strerror(errno)); \
 	else \
 	info(1, "remove service %s/%s%s\n", path, rcd, x); }))
 #else
-# define xremove(d,x) (__extension__ ({ if ((dryrun ? 0 : (remove(x) != 0))) \
+# define xremove(d,x) (__extension__ ({ if ((dryrun ? 0 : (stats_add(CNT_UNLINK,1), remove(x) != 0))) \
 	warn ("can not remove(%s/%s%s): %s\n", path, rcd, x, strerror(errno)); \
 	else \
 	info(1, "remove service %s/%s%s\n", path, rcd, x); }))
 #endif
 #if defined(HAS_symlinkat) && defined(_ATFILE_SOURCE) && !defined(__stub_symlinkat)
-# define xsymlink(d,x,y) (__extension__ ({ if ((dryrun ? 0 : (symlinkat(x, d, y) != 0))) \
+# define xsymlink(d,x,y) (__extension__ ({ if ((dryrun ? 0 : (stats_add(CNT_SYMLINK,1), symlinkat(x, d, y) != 0))) \
 	warn ("can not symlink(%s, %s/%s%s): %s\n", x, path, rcd, y, strerror(errno)); \
 	else \
 	info(1, "enable service %s -> %s/%s%s\n", x, path, rcd, y); }))
 #else
-# define xsymlink(d,x,y) (__extension__ ({ if ((dryrun ? 0 : (symlink(x, y) != 0))) \
+# define xsymlink(d,x,y) (__extension__ ({ if ((dryrun ? 0 : (stats_add(CNT_SYMLINK,1), symlink(x, y) != 0))) \
 	warn ("can not symlink(%s, %s/%s%s): %s\n", x, path, rcd, y, strerror(errno)); \
 	else \
 	info(1, "enable service %s -> %s/%s%s\n", x, path, rcd, y); }))
 #endif
 #if defined(HAS_fstatat) && defined(_ATFILE_SOURCE) && !defined(__stub_fstatat)
-# define xstat(d,x,s)	(__extension__ ({ fstatat(d,x,s, 0); }))
-# define xlstat(d,x,s)	(__extension__ ({ fstatat(d,x,s, AT_SYMLINK_NOFOLLOW); }))
+# define xstat(d,x,s)	(__extension__ ({ stats_add(CNT_STAT,1); fstatat(d,x,s, 0); }))
+# define xlstat(d,x,s)	(__extension__ ({ stats_add(CNT_LSTAT,1); fstatat(d,x,s, AT_SYMLINK_NOFOLLOW); }))
 #else
-# define xstat(d,x,s)	(__extension__ ({ stat(x,s); }))
-# define xlstat(d,x,s)	(__extension__ ({ lstat(x,s); }))
+# define xstat(d,x,s)	(__extension__ ({ stats_add(CNT_STAT,1); stat(x,s); }))
+# define xlstat(d,x,s)	(__extension__ ({ stats_add(CNT_LSTAT,1); lstat(x,s); }))
 #endif
 #if defined(HAS_readlinkat) && defined(_ATFILE_SOURCE) && !defined(__stub_readlinkat)
-# define xreadlink(d,x,b,l)	(__extension__ ({ readlinkat(d,x,b,l); }))
+# define xreadlink(d,x,b,l)	(__extension__ ({ stats_add(CNT_READLINK,1); readlinkat(d,x,b,l); }))
 #else
-# define xreadlink(d,x,b,l)	(__extension__ ({ readlink(x,b,l); }))
+# define xreadlink(d,x,b,l)	(__extension__ ({ stats_add(CNT_READLINK,1); readlink(x,b,l); }))
 #endif
 #if defined(HAS_openat) && defined(_ATFILE_SOURCE) && !defined(__stub_openat)
-# define xopen(d,x,f)	(__extension__ ({ openat(d,x,f); }))
+# define xopen(d,x,f)	(__extension__ ({ stats_add(CNT_OPEN,1); openat(d,x,f); }))
 #else
-# define xopen(d,x,f)	(__extension__ ({ open(x,f); }))
+# define xopen(d,x,f)	(__extension__ ({ stats_add(CNT_OPEN,1); open(x,f); }))
 #endif
 
 /*
@@ -399,6 +452,8 @@ extern char empty[];
 #define REQ_MUST	0x0001
 #define REQ_SHLD	0x0002
 #define REQ_KILL	0x0004
+#define REQ_REV		0x0008	/* From X-Start-Before or X-Stop-After */
+#define REQ_ALL		0x0010	/* From the `$all' facility */
 
 /*
  * Bits of the services
@@ -417,6 +472,7 @@ extern char empty[];
 #define SERV_ENFORCE	0x0800
 #define SERV_WARNED	0x1000
 #define SERV_SYSTEMD	0x2000
+#define SERV_REMOVE	0x4000
 
 /*
  * Bits of the runlevels
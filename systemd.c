@@ -1,6 +1,7 @@
 #ifdef WANT_SYSTEMD
 /*
- * systemd.c	    Use dbus API of systemd to import dependencies from.
+ * systemd.c	    Import the dependencies of systemd from its unit files
+ *		    or with the dbus API of systemd.
  *
  * Copyright 2012 Werner Fink, 2012 SUSE LINUX Products GmbH, Germany.
  *
@@ -30,6 +31,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
 #include "listing.h"
 #include "systemd.h"
 
@@ -123,6 +127,24 @@ static void systemd_strip_dot(void)
     }
 }
 
+typedef struct {
+    const char *const tag;
+    ushort flag;
+} relation_t;
+
+static const relation_t relations[] = {
+    { "Requires",		SDREL_REQUIRES	},
+    { "RequiresOverridable",	SDREL_REQUIRES	},
+    { "Requisite",		SDREL_REQUISITE	},
+    { "RequisiteOverridable",	SDREL_REQUISITE	},
+    { "Wants",			SDREL_WANTS	},
+    { "Conflicts",		SDREL_CONFLICTS	},
+    { "Before",			SDREL_BEFORE	},
+    { "After",			SDREL_AFTER	},
+    { (const char*)0,		0		}
+};
+
+#ifdef WANT_SYSTEMD_DBUS
 static int iter_get_and_next(DBusMessageIter *iter, int type, void *data)
 {
     if (dbus_message_iter_get_arg_type(iter) != type)
@@ -135,24 +157,8 @@ err:
     return 0;
 }
 
-typedef struct {
-    const char *const tag;
-    ushort flag;
-} relation_t;
-
 static int handle_one_property(sdserv_t *one, const char *prop, DBusMessageIter *iter)
 {
-    static relation_t relations[] = {
-	{ "Requires",			SDREL_REQUIRES	},
-	{ "RequiresOverridable",	SDREL_REQUIRES	},
-	{ "Requisite",			SDREL_REQUISITE	},
-	{ "RequisiteOverridable",	SDREL_REQUISITE	},
-	{ "Wants",			SDREL_WANTS	},
-	{ "Conflicts",			SDREL_CONFLICTS	},
-	{ "Before",			SDREL_BEFORE	},
-	{ "After",			SDREL_AFTER	},
-	{ (const char*)0,		0		}
-    };
     const relation_t *relation = (relation_t*)0;
     int i;
 
@@ -215,40 +221,15 @@ failed:
     return 0;
 }
 
-static int handle_one_id(DBusConnection *bus, sdserv_t * serv, const char *path)
+/*
+ * Parse the reply of GetAll for the properties of one unit
+ */
+static int handle_one_reply(sdserv_t * serv, DBusMessage *reply)
 {
-    DBusError error;
-    const char *device = "org.freedesktop.systemd1.Unit";
-    DBusMessage *reply, *send;
     DBusMessageIter iter, isub;
-    int ret = 0;
-
-    dbus_error_init(&error);
-    send = dbus_message_new_method_call("org.freedesktop.systemd1",
-					 path,
-					"org.freedesktop.DBus.Properties",
-					"GetAll");
-    if (!send)
-	goto err;
-    dbus_message_set_auto_start(send, TRUE);
-    if (!dbus_message_set_destination(send, "org.freedesktop.systemd1"))
-	goto err;
-
-    dbus_message_iter_init_append(send, &iter);
-    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &device);
-
-    reply = dbus_connection_send_with_reply_and_block(bus, send, -1, &error);
-    dbus_message_unref(send);
 
-    if (dbus_error_is_set(&error)) {
-	warn ("can not connect system dbus: %s\n", error.message);
-	dbus_error_free(&error);
-	goto err;
-    }
-    if (!reply)
-	goto err;
     if (dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_METHOD_RETURN)
-	goto unref;
+	return 0;
 
     if (!dbus_message_iter_init(reply, &iter) ||
 	dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY ||
@@ -281,22 +262,154 @@ static int handle_one_id(DBusConnection *bus, sdserv_t * serv, const char *path)
 
     } while (TRUE);
 
-    ret = 1;
-    goto unref;
+    return 1;
 failed:
     warn ("failed to parse reply from systemd\n");
+    return 0;
+}
+
+/*
+ * The GetAll requests are sent without waiting for the replies,
+ * up to GETALL_WINDOW requests are on the way at once.  The replies
+ * are parsed in the order they arrive.
+ */
+#define GETALL_WINDOW	64
+static struct getall_struct {
+    DBusPendingCall * call[GETALL_WINDOW];
+    sdserv_t	    * serv[GETALL_WINDOW];
+    int			busy;
+} getall;
+
+/* Milliseconds left until the deadline */
+static int getall_left(const struct timespec *deadline)
+{
+    struct timespec now;
+    long left;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    left = (deadline->tv_sec - now.tv_sec) * 1000L + (deadline->tv_nsec - now.tv_nsec) / 1000000L;
+    return left > 0 ? (int)left : 0;
+}
+
+/*
+ * Ask for the properties of one unit, the reply is parsed later
+ */
+static int handle_one_id(DBusConnection *bus, sdserv_t * serv, const char *path,
+			 const struct timespec *deadline)
+{
+    const char *device = "org.freedesktop.systemd1.Unit";
+    DBusPendingCall *call = (DBusPendingCall*)0;
+    DBusMessage *send;
+    DBusMessageIter iter;
+    const int left = getall_left(deadline);
+    int n;
+
+    if (left == 0)
+	goto err;
+    send = dbus_message_new_method_call("org.freedesktop.systemd1",
+					 path,
+					"org.freedesktop.DBus.Properties",
+					"GetAll");
+    if (!send)
+	goto err;
+    dbus_message_set_auto_start(send, TRUE);
+    if (!dbus_message_set_destination(send, "org.freedesktop.systemd1"))
+	goto unref;
+
+    dbus_message_iter_init_append(send, &iter);
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &device);
+
+    if (!dbus_connection_send_with_reply(bus, send, &call, left) || !call) {
+	warn ("can not connect system dbus\n");
+	goto unref;
+    }
+    dbus_message_unref(send);
+
+    for (n = 0; n < GETALL_WINDOW; n++) {
+	if (getall.call[n])
+	    continue;
+	getall.call[n] = call;
+	getall.serv[n] = serv;
+	getall.busy++;
+	break;
+    }
+    return 1;
 unref:
-    dbus_message_unref(reply);
+    dbus_message_unref(send);
 err:
-    return ret;
+    return 0;
+}
+
+/*
+ * Parse the replies arrived so far
+ */
+static void getall_reap(void)
+{
+    int n;
+
+    for (n = 0; n < GETALL_WINDOW; n++) {
+	DBusPendingCall *call = getall.call[n];
+	DBusMessage *reply;
+
+	if (!call || !dbus_pending_call_get_completed(call))
+	    continue;
+	if ((reply = dbus_pending_call_steal_reply(call))) {
+	    handle_one_reply(getall.serv[n], reply);
+	    dbus_message_unref(reply);
+	}
+	dbus_pending_call_unref(call);
+	getall.call[n] = (DBusPendingCall*)0;
+	getall.busy--;
+    }
 }
 
-int systemd_get_tree(DBusConnection *bus)
+/*
+ * Wait for replies until not more than busy requests are left
+ */
+static int getall_wait(DBusConnection *bus, const int busy, const struct timespec *deadline)
+{
+    getall_reap();
+    while (getall.busy > busy) {
+	const int left = getall_left(deadline);
+	if (left == 0)
+	    return 0;
+	if (!dbus_connection_read_write_dispatch(bus, left))
+	    return 0;
+	getall_reap();
+    }
+    return 1;
+}
+
+/*
+ * Forget the requests without reply
+ */
+static void getall_cancel(void)
+{
+    int n;
+
+    if (getall.busy)
+	warn ("no reply from systemd for %d units\n", getall.busy);
+    for (n = 0; n < GETALL_WINDOW; n++) {
+	DBusPendingCall *call = getall.call[n];
+	if (!call)
+	    continue;
+	dbus_pending_call_cancel(call);
+	dbus_pending_call_unref(call);
+	getall.call[n] = (DBusPendingCall*)0;
+    }
+    getall.busy = 0;
+}
+
+int systemd_get_tree(DBusConnection *bus, const int timeout)
 {
     DBusError error;
     DBusMessage *reply, *send;
     DBusMessageIter iter, isub;
-    int ret = 0;
+    struct timespec deadline;
+    int ret = 0, skipped = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout;
 
     dbus_error_init(&error);
     send = dbus_message_new_method_call("org.freedesktop.systemd1",
@@ -309,7 +422,7 @@ int systemd_get_tree(DBusConnection *bus)
     if (!dbus_message_set_destination(send, "org.freedesktop.systemd1"))
 	goto err;
 
-    reply = dbus_connection_send_with_reply_and_block(bus, send, -1, &error);
+    reply = dbus_connection_send_with_reply_and_block(bus, send, getall_left(&deadline), &error);
     dbus_message_unref(send);
 
     if (dbus_error_is_set(&error)) {
@@ -364,12 +477,20 @@ printf("id=%s ls=%s as=%s subs=%s fl=%s %s ID=%u jt=%s jp=%s\n",
 	id, load_state, active_state, sub_state, following, unit_path,
 	job_id, sjob_type, j_path);
 #endif
+	/*
+	 * Once a request could not be sent the remaining
+	 * units are only counted, the deadline has passed
+	 * or the connection is lost.
+	 */
 	if ((dot = strrchr(id, '.'))) {
 	    dot++;
 	    if (strcmp(dot, "target") == 0 || strcmp(dot, "service") == 0) {
-		sdserv_t * serv;
-		serv = addsysd(id);
-		handle_one_id(bus, serv, unit_path);
+		if (skipped)
+		    skipped++;
+		else if (getall.busy == GETALL_WINDOW && !getall_wait(bus, GETALL_WINDOW-1, &deadline))
+		    skipped++;
+		else if (!handle_one_id(bus, addsysd(id), unit_path, &deadline))
+		    skipped++;
 	    }
 	}
 
@@ -377,12 +498,17 @@ printf("id=%s ls=%s as=%s subs=%s fl=%s %s ID=%u jt=%s jp=%s\n",
 
     } while (TRUE);
 
+    (void)getall_wait(bus, 0, &deadline);
+    getall_cancel();
+    if (skipped)
+	warn ("properties of %d units not asked from systemd\n", skipped);
     systemd_strip_dot();
 
     ret = 1;
     goto unref;
 failed:
     warn ("failed to parse reply from systemd\n");
+    getall_cancel();
 unref:
     dbus_message_unref(reply);
 err:
@@ -443,6 +569,448 @@ void systemd_close_conn(DBusConnection *bus)
 	dbus_connection_unref(bus);
     }
 }
+#endif /* WANT_SYSTEMD_DBUS */
+
+/*
+ * The directories of the unit files, a unit file found in a former
+ * directory hides those of the same name in the later directories.
+ */
+static const char *const unitdirs[] = {
+    "/etc/systemd/system",
+    "/run/systemd/system",
+    SYSTEMD_SERVICE_PATH,
+    "/usr/lib/systemd/system",
+    (const char*)0
+};
+#define UNITDIRS	(int)(sizeof(unitdirs)/sizeof(unitdirs[0]) - 1)
+
+#define SDUNIT_LOADED		(1<<0)	    /* The unit file has been read	*/
+#define SDUNIT_NODEFAULT	(1<<1)	    /* DefaultDependencies=no		*/
+
+/*
+ * Only services and targets are used, see handle_one_property(),
+ * templates like getty@.service are not units of their own.
+ */
+static boolean isunit(const char *restrict const name) attribute((nonnull(1)));
+static boolean isunit(const char *restrict const name)
+{
+    const char *dot = strrchr(name, '.');
+
+    if (!dot || dot == name || dot[-1] == '@' || strchr(name, '/'))
+	return false;
+    dot++;
+    return (strcmp(dot, "target") == 0 || strcmp(dot, "service") == 0);
+}
+
+/*
+ * Open a unit file in the directory dfd.  Symbolic links pointing
+ * to /dev/null mask the unit, absolute links are followed below of
+ * the root.
+ */
+static FILE * unit_open(const char *restrict const root, const int dfd,
+			const char *restrict const name) attribute((nonnull(3)));
+static FILE * unit_open(const char *restrict const root, const int dfd,
+			const char *restrict const name)
+{
+    char link[PATH_MAX+1];
+    FILE * unit;
+    ssize_t len;
+    int fd;
+
+    if ((len = readlinkat(dfd, name, link, sizeof(link)-1)) < 0)
+	fd = openat(dfd, name, O_RDONLY|O_CLOEXEC);
+    else {
+	link[len] = '\0';
+	if (strcmp(link, "/dev/null") == 0)
+	    return (FILE*)0;
+	if (root && *link == '/') {
+	    char path[PATH_MAX+1];
+	    snprintf(path, sizeof(path), "%s%s", root, link);
+	    fd = open(path, O_RDONLY|O_CLOEXEC);
+	} else
+	    fd = openat(dfd, link, O_RDONLY|O_CLOEXEC);
+    }
+    if (fd < 0)
+	return (FILE*)0;
+    if (!(unit = fdopen(fd, "r")))
+	close(fd);
+    return unit;
+}
+
+/*
+ * The boolean values known by systemd, -1 for anything else
+ */
+static int unit_bool(const char *restrict const val) attribute((nonnull(1)));
+static int unit_bool(const char *restrict const val)
+{
+    static const char *const yes[] = { "1", "yes", "y", "true", "t", "on", (const char*)0 };
+    static const char *const no[]  = { "0", "no", "n", "false", "f", "off", (const char*)0 };
+    int n;
+
+    for (n = 0; yes[n]; n++) {
+	if (strcasecmp(val, yes[n]) == 0)
+	    return 1;
+	if (strcasecmp(val, no[n]) == 0)
+	    return 0;
+    }
+    return -1;
+}
+
+/*
+ * Parse the [Unit] section of a unit file or of a drop-in of a unit.
+ * Before and After are also added the other way round as systemd
+ * does for the properties of the units.  As with systemd an empty
+ * assignment like After= does not reset the dependencies, these can
+ * only be added by drop-ins.
+ */
+static void unit_parse(sdserv_t *restrict serv, FILE *restrict unit) attribute((nonnull(1,2)));
+static void unit_parse(sdserv_t *restrict serv, FILE *restrict unit)
+{
+    char * line = (char*)0, * next = (char*)0;
+    size_t size = 0, nsize = 0;
+    boolean section = false;
+    ssize_t len;
+
+    while ((len = getline(&line, &size, unit)) >= 0) {
+	const relation_t *relation = (relation_t*)0;
+	char *key, *val, *ally;
+	int i;
+
+	/* Join continued lines */
+	while (len > 0 && line[len-1] == '\n')
+	    line[--len] = '\0';
+	while (len > 0 && line[len-1] == '\\') {
+	    ssize_t nlen = getline(&next, &nsize, unit);
+	    if (nlen < 0)
+		break;
+	    line[len-1] = ' ';
+	    if (!(line = (char*)realloc(line, len + nlen + 1)))
+		error("%s", strerror(errno));
+	    size = len + nlen + 1;
+	    strcpy(line + len, next);
+	    len += nlen;
+	    while (len > 0 && line[len-1] == '\n')
+		line[--len] = '\0';
+	}
+
+	key = line + strspn(line, " \t");
+	if (*key == '[') {
+	    section = (strncmp(key, "[Unit]", 6) == 0);
+	    continue;
+	}
+	if (!section || *key == '#' || *key == ';')
+	    continue;
+	if (!(val = strchr(key, '=')))
+	    continue;
+	*val++ = '\0';
+	key[strcspn(key, " \t")] = '\0';
+
+	if (strcmp(key, "DefaultDependencies") == 0) {
+	    val += strspn(val, " \t");
+	    val[strcspn(val, " \t")] = '\0';
+	    switch (unit_bool(val)) {
+	    case 0:
+		serv->flags |= SDUNIT_NODEFAULT;
+		break;
+	    case 1:
+		serv->flags &= ~SDUNIT_NODEFAULT;
+		break;
+	    default:
+		break;
+	    }
+	    continue;
+	}
+
+	for (i = 0; relations[i].tag; i++) {
+	    if (strcmp(relations[i].tag, key) == 0) {
+		relation = &relations[i];
+		break;
+	    }
+	}
+	if (!relation)
+	    continue;
+
+	while ((ally = strsep(&val, " \t"))) {
+	    sdserv_t * other;
+
+	    if (*ally == '\0' || !isunit(ally))
+		continue;
+	    other = addsysd(ally);
+	    addally(serv, other, relation->flag);
+	    if (relation->flag & SDREL_BEFORE)
+		addally(other, serv, SDREL_AFTER);
+	    if (relation->flag & SDREL_AFTER)
+		addally(other, serv, SDREL_BEFORE);
+	}
+    }
+    free(next);
+    free(line);
+}
+
+/*
+ * The links in the <unit>.wants/ and <unit>.requires/ directories
+ */
+static void unit_links(const int dfd, const char *restrict const name, const ushort flags) attribute((nonnull(2)));
+static void unit_links(const int dfd, const char *restrict const name, const ushort flags)
+{
+    char unit[PATH_MAX+1];
+    struct dirent *d;
+    sdserv_t *serv;
+    DIR *dir;
+    int fd;
+
+    snprintf(unit, sizeof(unit), "%s", name);
+    *strrchr(unit, '.') = '\0';
+    if (!isunit(unit))
+	return;
+    if ((fd = openat(dfd, name, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0)
+	return;
+    if (!(dir = fdopendir(fd))) {
+	close(fd);
+	return;
+    }
+    serv = addsysd(unit);
+    while ((d = readdir(dir))) {
+	if (*d->d_name == '.' || !isunit(d->d_name))
+	    continue;
+	addally(serv, addsysd(d->d_name), flags);
+    }
+    closedir(dir);
+}
+
+/*
+ * A unit is masked if the first unit file found is a link to /dev/null
+ */
+static boolean unit_masked(const int dfd[], const char *restrict const name) attribute((nonnull(1,2)));
+static boolean unit_masked(const int dfd[], const char *restrict const name)
+{
+    char link[PATH_MAX+1];
+    struct stat st;
+    ssize_t len;
+    int n;
+
+    for (n = 0; n < UNITDIRS; n++) {
+	if (dfd[n] < 0 || fstatat(dfd[n], name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+	    continue;
+	if ((len = readlinkat(dfd[n], name, link, sizeof(link)-1)) < 0)
+	    return false;
+	link[len] = '\0';
+	return (strcmp(link, "/dev/null") == 0);
+    }
+    return false;
+}
+
+/*
+ * The drop-ins found in the <unit>.d/ directories, not for masked units
+ */
+static void unit_dropins(const char *restrict const root, const int dfds[], const int n,
+			 const char *restrict const name) attribute((nonnull(2,4)));
+static void unit_dropins(const char *restrict const root, const int dfds[], const int n,
+			 const char *restrict const name)
+{
+    char unit[PATH_MAX+1];
+    struct dirent *d;
+    sdserv_t *serv;
+    DIR *dir;
+    int fd;
+
+    snprintf(unit, sizeof(unit), "%s", name);
+    *strrchr(unit, '.') = '\0';
+    if (!isunit(unit) || unit_masked(dfds, unit))
+	return;
+    if ((fd = openat(dfds[n], name, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0)
+	return;
+    if (!(dir = fdopendir(fd))) {
+	close(fd);
+	return;
+    }
+    serv = addsysd(unit);
+    while ((d = readdir(dir))) {
+	const char *dot = strrchr(d->d_name, '.');
+	FILE *conf;
+
+	if (*d->d_name == '.' || !dot || strcmp(dot, ".conf"))
+	    continue;
+	if ((conf = unit_open(root, dirfd(dir), d->d_name))) {
+	    unit_parse(serv, conf);
+	    fclose(conf);
+	}
+    }
+    closedir(dir);
+}
+
+/*
+ * The implicit dependencies added by systemd to the units read if
+ * not switched off by DefaultDependencies=no, see systemd.service(5)
+ * and systemd.target(5).  Services require and are ordered after
+ * sysinit.target and after basic.target, both services and targets
+ * conflict with and are ordered before shutdown.target, and targets
+ * are ordered after the units they want or require.
+ */
+static void unit_defaults(void)
+{
+    sdserv_t *sysinit = (sdserv_t*)0, *basic = (sdserv_t*)0, *shutdown = (sdserv_t*)0;
+    list_t *ptr;
+
+    list_for_each(ptr, sdservs_start) {
+	sdserv_t *serv = list_entry(ptr, sdserv_t, s_list);
+	const char *dot = strrchr(serv->unit, '.');
+	list_t *aptr;
+
+	if ((serv->flags & (SDUNIT_LOADED|SDUNIT_NODEFAULT)) != SDUNIT_LOADED || !dot)
+	    continue;
+
+	if (!shutdown)
+	    shutdown = addsysd("shutdown.target");
+	if (serv != shutdown) {
+	    addally(serv, shutdown, SDREL_CONFLICTS|SDREL_BEFORE);
+	    addally(shutdown, serv, SDREL_AFTER);
+	}
+
+	if (strcmp(dot, ".service") == 0) {
+	    if (!sysinit) {
+		sysinit = addsysd("sysinit.target");
+		basic = addsysd("basic.target");
+	    }
+	    addally(serv, sysinit, SDREL_REQUIRES|SDREL_AFTER);
+	    addally(sysinit, serv, SDREL_BEFORE);
+	    addally(serv, basic, SDREL_AFTER);
+	    addally(basic, serv, SDREL_BEFORE);
+	    continue;
+	}
+
+	list_for_each(aptr, &serv->a_list) {
+	    ally_t *ally = list_entry(aptr, ally_t, a_list);
+
+	    if (ally->serv == serv || (ally->serv->flags & SDUNIT_NODEFAULT))
+		continue;
+	    if (!(ally->flags & (SDREL_WANTS|SDREL_REQUIRES|SDREL_REQUISITE)))
+		continue;
+	    if (ally->flags & SDREL_BEFORE)
+		continue;			/* Do not create loops */
+	    ally->flags |= SDREL_AFTER;
+	    addally(ally->serv, serv, SDREL_BEFORE);
+	}
+    }
+}
+
+/*
+ * Read the dependencies of the services and targets from the unit
+ * files below of root without asking systemd, this also works in a
+ * chroot or for an other root.  The drop-ins are read after all unit
+ * files and the implicit dependencies are added at last.
+ */
+int systemd_read_tree(const char *const root)
+{
+    int dfd[UNITDIRS];
+    int n, pass;
+
+    for (n = 0; n < UNITDIRS; n++) {
+	char path[PATH_MAX+1];
+	snprintf(path, sizeof(path), "%s%s", root ? root : "", unitdirs[n]);
+	dfd[n] = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+	for (n = 0; n < UNITDIRS; n++) {
+	    struct dirent *d;
+	    DIR *dir;
+	    int fd;
+
+	    if (dfd[n] < 0)
+		continue;
+	    if ((fd = dup(dfd[n])) < 0 || !(dir = fdopendir(fd))) {
+		if (fd >= 0)
+		    close(fd);
+		continue;
+	    }
+	    rewinddir(dir);			/* The dup shares the offset */
+
+	    while ((d = readdir(dir))) {
+		const char *const name = d->d_name;
+		const char *dot;
+		sdserv_t *serv;
+		FILE *unit;
+		int o;
+
+		if (*name == '.' || !(dot = strrchr(name, '.')))
+		    continue;
+
+		if (pass) {
+		    if (strcmp(dot, ".d") == 0)
+			unit_dropins(root, dfd, n, name);
+		    continue;
+		}
+
+		if (strcmp(dot, ".wants") == 0) {
+		    unit_links(dfd[n], name, SDREL_WANTS);
+		    continue;
+		}
+		if (strcmp(dot, ".requires") == 0) {
+		    unit_links(dfd[n], name, SDREL_REQUIRES);
+		    continue;
+		}
+
+		if (!isunit(name))
+		    continue;
+
+		for (o = 0; o < n; o++) {
+		    struct stat st;
+		    if (dfd[o] >= 0 && fstatat(dfd[o], name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+			break;
+		}
+		if (o < n)
+		    continue;		/* Hidden by a former directory */
+
+		if ((unit = unit_open(root, dfd[n], name))) {
+		    serv = addsysd(name);
+		    serv->flags |= SDUNIT_LOADED;
+		    unit_parse(serv, unit);
+		    fclose(unit);
+		}
+	    }
+	    closedir(dir);
+	}
+    }
+
+    for (n = 0; n < UNITDIRS; n++)
+	if (dfd[n] >= 0)
+	    close(dfd[n]);
+
+    unit_defaults();
+    systemd_strip_dot();
+    return 1;
+}
+
+/*
+ * Collect the names of all service units found in the unit
+ * directories below of root, masked units included, into the set.
+ * These services shadow the scripts of the same name.
+ */
+void systemd_read_shadows(const char *const root, hash_t *restrict const set)
+{
+    int n;
+
+    for (n = 0; n < UNITDIRS; n++) {
+	char path[PATH_MAX+1];
+	struct dirent *d;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "%s%s", root ? root : "", unitdirs[n]);
+	if (!(dir = opendir(path)))
+	    continue;
+	while ((d = readdir(dir))) {
+	    const char *dot = strrchr(d->d_name, '.');
+	    char name[PATH_MAX+1];
+
+	    if (*d->d_name == '.' || !dot || strcmp(dot, ".service") || !isunit(d->d_name))
+		continue;
+	    snprintf(name, sizeof(name), "%.*s", (int)(dot - d->d_name), d->d_name);
+	    *hash_put(set, intern(name)) = (void*)set;
+	}
+	closedir(dir);
+    }
+}
 
 void systemd_free(void)
 {
@@ -20,10 +20,18 @@
  *
  */
 
+#ifndef SYSTEMD_SERVICE_PATH
+# define SYSTEMD_SERVICE_PATH	"/lib/systemd/system"
+#endif
+
+#ifdef WANT_SYSTEMD_DBUS
 #include <dbus/dbus.h>
-extern int systemd_get_tree(DBusConnection *bus);
+extern int systemd_get_tree(DBusConnection *bus, const int timeout);
 extern DBusConnection * systemd_open_conn(void);
 extern void systemd_close_conn(DBusConnection *bus);
+#endif /* WANT_SYSTEMD_DBUS */
+extern int systemd_read_tree(const char *const root);
+extern void systemd_read_shadows(const char *const root, hash_t *restrict const set);
 extern void systemd_free(void);
 
 /*
@@ -42,6 +50,7 @@ struct sdserv {
     list_t	a_list;
     char	 *unit;
     char	 *name;
+    ushort	 flags;
 };
 
 extern list_t sdservs;
@@ -0,0 +1,232 @@
+/*
+ * uring.c
+ *
+ * This source is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "listing.h"
+#include "uring.h"
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+
+/*
+ * The rings shared with the kernel, set up with the raw system
+ * calls to do without liburing.  Only one thread uses the rings.
+ */
+static struct uring_struct {
+    int			      fd;
+    uint		 entries;
+    uint	       * sq_head;
+    uint	       * sq_tail;
+    uint	       * sq_mask;
+    uint	      * sq_array;
+    uint	       * cq_head;
+    uint	       * cq_tail;
+    uint	       * cq_mask;
+    struct io_uring_sqe	   * sqe;
+    struct io_uring_cqe	   * cqe;
+    void	       * sq_ring;
+    void	       * cq_ring;
+    size_t		 sq_size;
+    size_t		 cq_size;
+} ring = { .fd = -1 };
+
+boolean uring_open(const uint entries)
+{
+    struct io_uring_params p;
+    uchar * sq, * cq;
+    void * sqe;
+    int fd;
+
+    if (ring.fd >= 0)
+	return true;
+
+    memset(&p, 0, sizeof(p));
+    if ((fd = (int)syscall(__NR_io_uring_setup, entries, &p)) < 0)
+	return false;			/* No kernel support or not allowed */
+
+    ring.sq_size = p.sq_off.array + p.sq_entries * sizeof(uint);
+    ring.cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (ring.cq_size > ring.sq_size)
+	    ring.sq_size = ring.cq_size;
+	ring.cq_size = ring.sq_size;
+    }
+
+    sq = mmap((void*)0, ring.sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+	goto err;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	cq = sq;
+    else {
+	cq = mmap((void*)0, ring.cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if (cq == MAP_FAILED) {
+	    munmap(sq, ring.sq_size);
+	    goto err;
+	}
+    }
+    sqe = mmap((void*)0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE,
+	       MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqe == MAP_FAILED) {
+	if (cq != sq)
+	    munmap(cq, ring.cq_size);
+	munmap(sq, ring.sq_size);
+	goto err;
+    }
+
+    ring.fd	  = fd;
+    ring.entries  = p.sq_entries;
+    ring.sq_ring  = sq;
+    ring.cq_ring  = cq;
+    ring.sq_head  = (uint*)(sq + p.sq_off.head);
+    ring.sq_tail  = (uint*)(sq + p.sq_off.tail);
+    ring.sq_mask  = (uint*)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (uint*)(sq + p.sq_off.array);
+    ring.cq_head  = (uint*)(cq + p.cq_off.head);
+    ring.cq_tail  = (uint*)(cq + p.cq_off.tail);
+    ring.cq_mask  = (uint*)(cq + p.cq_off.ring_mask);
+    ring.cqe	  = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    ring.sqe	  = (struct io_uring_sqe*)sqe;
+    return true;
+err:
+    close(fd);
+    return false;
+}
+
+static void uring_prep(struct io_uring_sqe *restrict const sqe, const uring_op_t *restrict const op,
+		       const uint n) attribute((nonnull(1,2)));
+static void uring_prep(struct io_uring_sqe *restrict const sqe, const uring_op_t *restrict const op,
+		       const uint n)
+{
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->fd = op->dfd;
+    sqe->user_data = n;
+    switch (op->opcode) {
+    case URING_STATX:
+	sqe->opcode = IORING_OP_STATX;
+	sqe->addr = (unsigned long)op->path;
+	sqe->addr2 = (unsigned long)op->buf;
+	sqe->len = STATX_BASIC_STATS;
+	sqe->statx_flags = op->flags;
+	break;
+    case URING_OPENAT:
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->addr = (unsigned long)op->path;
+	sqe->open_flags = op->flags;
+	break;
+    case URING_READ:
+	sqe->opcode = IORING_OP_READ;
+	sqe->addr = (unsigned long)op->buf;
+	sqe->len = op->len;
+	break;
+    case URING_CLOSE:
+	sqe->opcode = IORING_OP_CLOSE;
+	break;
+    default:
+	sqe->opcode = IORING_OP_NOP;
+	break;
+    }
+}
+
+/*
+ * Do all requests of the list, as many at once as the rings take.
+ * The results are found in the res members of the requests.  If
+ * the kernel refuses the rings the requests not done are marked
+ * with -ECANCELED and false is returned.
+ */
+boolean uring_run(uring_op_t *restrict const op, const uint count)
+{
+    const uint sqmask = *ring.sq_mask, cqmask = *ring.cq_mask;
+    uint next = 0, done = 0, busy = 0, n;
+
+    if (ring.fd < 0)
+	return false;
+    for (n = 0; n < count; n++)
+	op[n].res = -ECANCELED;
+
+    while (done < count) {
+	uint head, tail = *ring.sq_tail;
+	int ret;
+
+	while (next < count && busy < ring.entries) {
+	    const uint idx = tail & sqmask;
+	    uring_prep(&ring.sqe[idx], &op[next], next);
+	    ring.sq_array[idx] = idx;
+	    tail++;
+	    next++;
+	    busy++;
+	}
+	__atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+	stats_add(CNT_URING, 1);
+	ret = (int)syscall(__NR_io_uring_enter, ring.fd, tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE),
+			   1, IORING_ENTER_GETEVENTS, (void*)0, 0);
+	if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+	    return false;
+
+	head = *ring.cq_head;
+	tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+	    const struct io_uring_cqe * cqe = &ring.cqe[head & cqmask];
+	    op[cqe->user_data].res = cqe->res;
+	    head++;
+	    done++;
+	    busy--;
+	}
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+void uring_close(void)
+{
+    if (ring.fd < 0)
+	return;
+    munmap(ring.sqe, ring.entries * sizeof(struct io_uring_sqe));
+    if (ring.cq_ring != ring.sq_ring)
+	munmap(ring.cq_ring, ring.cq_size);
+    munmap(ring.sq_ring, ring.sq_size);
+    close(ring.fd);
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+#else  /* not io_uring */
+
+boolean uring_open(const uint entries attribute((unused)))
+{
+    return false;
+}
+
+boolean uring_run(uring_op_t *restrict const op attribute((unused)), const uint count attribute((unused)))
+{
+    return false;
+}
+
+void uring_close(void)
+{
+}
+
+#endif /* not io_uring */
@@ -0,0 +1,42 @@
+/*
+ * uring.h
+ *
+ * This source is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ */
+
+/*
+ * Batches of file system requests done by io_uring(7).
+ */
+enum uring_opcode {
+    URING_STATX = 0,		/* statx(dfd, path, flags, STATX_BASIC_STATS, buf) */
+    URING_OPENAT,		/* openat(dfd, path, flags) */
+    URING_READ,			/* pread(dfd, buf, len, 0) */
+    URING_CLOSE,		/* close(dfd) */
+};
+
+typedef struct uring_op_struct {
+    uchar		  opcode;
+    int			     dfd;
+    const char		 * path;
+    void		  * buf;
+    uint		     len;
+    int			   flags;
+    int			     res;	/* Result or negative error number */
+} uring_op_t;
+
+extern boolean uring_open(const uint entries);
+extern boolean uring_run(uring_op_t *restrict const op, const uint count) attribute((nonnull(1)));
+extern void uring_close(void);